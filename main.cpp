@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
 #include <cctype>
 #include <fstream>
 #include <sstream>
@@ -10,6 +11,7 @@
 #include <ctime>
 #include <vector>
 #include <algorithm>
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <chrono>
@@ -19,52 +21,163 @@
 #include <filesystem>
 #include <locale>
 #include <functional>
+#include <list>
+#include <deque>
+#include <string_view>
 #include <random>
 #include <atomic>
+#include <array>
+#include <bitset>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 using namespace std;
 namespace fs = std::filesystem;
 
 // Constants
-const int ALPHABET_SIZE = 26;
-const int MAX_FILES = 100;
 const int MAX_WORD_LENGTH = 100;
 const int MAX_SUGGESTIONS = 50;
 const int MAX_RESULTS = 100;
 const int MAX_HISTORY = 20;
+const int PARTIAL_SEARCH_PAGE_SIZE = 10; // Matches shown per page in the menu
 const int MAX_EDIT_DISTANCE = 2; // For spell checking
+const long long CHUNKED_INDEX_MIN_BYTES = 8LL * 1024 * 1024; // Files this large are split across threads
+const int CHUNK_READ_BUFFER_SIZE = 64 * 1024;
 
 // Forward declaration
-void processFile(const string &filename, class Trie &trie);
+template <class Alphabet>
+class BasicTrie;
 
-// Spell checker and search history structures
+const char *const QUERY_LOG_FILE = "search_history.log"; // Append-only "count<TAB>query" lines
+const int QUERY_LOG_COMPACT_RATIO = 4;                     // Rewrite the log once it is this many times its distinct queries
+const int HOT_QUERY_WARM_COUNT = 32;                       // Most frequent logged queries warmed at startup
+
+// Search history: a ring of recent queries in memory backed by a persistent
+// query log. The log is replayed at startup to restore the ring and the
+// per-query counts that feed cache warming and autocomplete ranking.
 struct SearchHistory
 {
     char queries[MAX_HISTORY][MAX_WORD_LENGTH];
-    int count;
+    int head;  // Slot of the oldest query
+    int count; // Queries in the ring
+    unordered_map<string, int> counts;
+    string logPath;
+
+    SearchHistory() : head(0), count(0) {}
 
-    SearchHistory() : count(0) {}
+    // i = 0 is the most recent query
+    const char *recent(int i) const
+    {
+        return queries[(head + count - 1 - i) % MAX_HISTORY];
+    }
 
     void addQuery(const char *query)
     {
-        // Don't add duplicates of the last query
-        if (count > 0 && strcmp(queries[count - 1], query) == 0)
+        if (query[0] == '\0')
         {
             return;
         }
 
-        // Shift if history is full
-        if (count >= MAX_HISTORY)
+        counts[query]++;
+        if (!logPath.empty())
+        {
+            FILE *file = fopen(logPath.c_str(), "a");
+            if (file)
+            {
+                fprintf(file, "1\t%s\n", query);
+                fclose(file);
+            }
+        }
+        remember(query);
+    }
+
+    // Replay the query log at path and keep appending to it. Returns the
+    // number of log records read.
+    int open(const char *path)
+    {
+        logPath = path;
+        ifstream file(path);
+        if (!file)
+        {
+            return 0;
+        }
+
+        // Queries in order of their latest appearance, for compaction
+        vector<string> order;
+        unordered_map<string, size_t> lastSeen;
+        int records = 0;
+        string line;
+        while (getline(file, line))
         {
-            for (int i = 0; i < MAX_HISTORY - 1; i++)
+            size_t tab = line.find('\t');
+            if (tab == string::npos || tab + 1 == line.size())
             {
-                strcpy(queries[i], queries[i + 1]);
+                continue;
+            }
+            int weight = atoi(line.c_str());
+            string query = line.substr(tab + 1);
+            if (weight <= 0)
+            {
+                continue;
             }
-            count = MAX_HISTORY - 1;
+
+            records++;
+            counts[query] += weight;
+            remember(query.c_str());
+            lastSeen[query] = order.size();
+            order.push_back(query);
+        }
+
+        if (records > QUERY_LOG_COMPACT_RATIO * (int)lastSeen.size())
+        {
+            compact(order, lastSeen);
         }
+        return records;
+    }
+
+    // Most frequently logged queries, most frequent first
+    vector<pair<string, int>> hottest(int limit) const
+    {
+        vector<pair<string, int>> ranked(counts.begin(), counts.end());
+        sort(ranked.begin(), ranked.end(), [](const pair<string, int> &a, const pair<string, int> &b)
+             { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+        if ((int)ranked.size() > limit)
+        {
+            ranked.resize(limit);
+        }
+        return ranked;
+    }
 
-        // Add new query
-        strncpy(queries[count++], query, MAX_WORD_LENGTH);
+    void clear()
+    {
+        head = 0;
+        count = 0;
+        counts.clear();
+        if (!logPath.empty())
+        {
+            FILE *file = fopen(logPath.c_str(), "w");
+            if (file)
+            {
+                fclose(file);
+            }
+        }
     }
 
     void display()
@@ -76,1128 +189,8171 @@ struct SearchHistory
         }
 
         cout << "Search History:\n";
-        for (int i = count - 1; i >= 0; i--)
+        for (int i = 0; i < count; i++)
+        {
+            cout << (i + 1) << ". " << recent(i) << endl;
+        }
+    }
+
+private:
+    void remember(const char *query)
+    {
+        // Don't add duplicates of the last query
+        if (count > 0 && strcmp(recent(0), query) == 0)
+        {
+            return;
+        }
+
+        int slot;
+        if (count < MAX_HISTORY)
+        {
+            slot = (head + count++) % MAX_HISTORY;
+        }
+        else
+        {
+            // Full: overwrite the oldest entry instead of shifting
+            slot = head;
+            head = (head + 1) % MAX_HISTORY;
+        }
+        strncpy(queries[slot], query, MAX_WORD_LENGTH - 1);
+        queries[slot][MAX_WORD_LENGTH - 1] = '\0';
+    }
+
+    // Rewrite the log with one aggregated record per query, ordered by latest
+    // appearance so a later replay restores the same recent history
+    void compact(const vector<string> &order, const unordered_map<string, size_t> &lastSeen)
+    {
+        string tempPath = logPath + ".tmp";
+        FILE *file = fopen(tempPath.c_str(), "w");
+        if (!file)
+        {
+            return;
+        }
+        for (size_t i = 0; i < order.size(); i++)
         {
-            cout << (count - i) << ". " << queries[i] << endl;
+            if (lastSeen.at(order[i]) == i)
+            {
+                fprintf(file, "%d\t%s\n", counts[order[i]], order[i].c_str());
+            }
         }
+        fclose(file);
+        rename(tempPath.c_str(), logPath.c_str());
     }
 };
 
+using DocId = uint32_t; // Document ids are dense, assigned in registration order
+
 struct FileInfo
 {
-    int fileId;
+    DocId fileId;
     int frequency;
+    int positionCount;              // Number of valid entries in positions
     int positions[MAX_WORD_LENGTH]; // Store word positions within document
 };
 
-struct TrieNode
+// Character sets the trie can branch on. An alphabet is built from a
+// membership test over bytes: its tables are computed at compile time,
+// slots follow byte order (so child order is strcmp order) and uppercase
+// ASCII letters fold to their lowercase slot. Characters outside the
+// alphabet are dropped from keys.
+template <bool (*Member)(unsigned char)>
+struct ByteAlphabet
 {
-    TrieNode *children[ALPHABET_SIZE]; // Use array instead of unordered_map
-    bool isEndOfWord;
-    char word[MAX_WORD_LENGTH]; // Use char array instead of string for better memory management
-    FileInfo fileInfo[MAX_FILES];
-    int fileInfoCount;
+private:
+    static constexpr int countMembers()
+    {
+        int count = 0;
+        for (int ch = 1; ch < 256; ch++)
+            count += Member(ch) ? 1 : 0;
+        return count;
+    }
 
-    TrieNode() : isEndOfWord(false), fileInfoCount(0)
+    static constexpr array<int16_t, 256> buildSlots()
     {
-        for (int i = 0; i < ALPHABET_SIZE; i++)
+        array<int16_t, 256> slots{};
+        int next = 0;
+        for (int ch = 0; ch < 256; ch++)
+            slots[ch] = ch != 0 && Member(ch) ? next++ : -1;
+        for (int ch = 'A'; ch <= 'Z'; ch++)
         {
-            children[i] = nullptr;
+            if (slots[ch] < 0)
+                slots[ch] = slots[ch - 'A' + 'a'];
         }
-        memset(word, 0, sizeof(word));
+        return slots;
+    }
+
+public:
+    static constexpr int SIZE = countMembers();
+    static constexpr array<int16_t, 256> SLOTS = buildSlots(); // Byte -> child slot, -1 outside
+
+private:
+    static constexpr array<char, SIZE> buildSymbols()
+    {
+        array<char, SIZE> symbols{};
+        for (int ch = 1; ch < 256; ch++)
+        {
+            if (Member(ch))
+                symbols[SLOTS[ch]] = static_cast<char>(ch);
+        }
+        return symbols;
+    }
+
+    static constexpr array<char, 256> buildKeyChars()
+    {
+        array<char, 256> keyChars{};
+        for (int ch = 0; ch < 256; ch++)
+            keyChars[ch] = SLOTS[ch] < 0 ? '\0' : SYMBOLS[SLOTS[ch]];
+        return keyChars;
     }
 
-    ~TrieNode()
+public:
+    static constexpr array<char, SIZE> SYMBOLS = buildSymbols();     // Child slot -> key byte
+    static constexpr array<char, 256> KEY_CHARS = buildKeyChars(); // Byte -> key byte, '\0' outside
+
+    // Child slot for ch, or -1 when ch is not in the alphabet
+    static int slot(char ch)
+    {
+        return SLOTS[static_cast<unsigned char>(ch)];
+    }
+
+    static char symbol(int slot)
+    {
+        return SYMBOLS[slot];
+    }
+
+    // ch as it appears in keys (case folded), or '\0' when it is dropped
+    static char keyChar(char ch)
     {
-        // No need to manually free memory as char array handles it
+        return KEY_CHARS[static_cast<unsigned char>(ch)];
     }
 };
 
-class Trie
+constexpr bool isLowercaseAsciiByte(unsigned char ch)
 {
-private:
-    TrieNode *root;
-    char fileList[MAX_FILES][MAX_WORD_LENGTH];
-    int fileListCount;
+    return ch >= 'a' && ch <= 'z';
+}
 
-    void destroyTrie(TrieNode *node)
+constexpr bool isAlphaNumericByte(unsigned char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9');
+}
+
+constexpr bool isFoldedByte(unsigned char ch)
+{
+    return !(ch >= 'A' && ch <= 'Z');
+}
+
+// Letters only: digits and punctuation are dropped (the original behaviour)
+struct LowercaseAscii : ByteAlphabet<isLowercaseAsciiByte>
+{
+    static constexpr const char *NAME = "lowercase ASCII";
+};
+
+// Letters and digits, so identifiers and version numbers stay searchable
+struct AlphaNumeric : ByteAlphabet<isAlphaNumericByte>
+{
+    static constexpr const char *NAME = "alphanumeric";
+};
+
+// Every byte of a token, including punctuation and UTF-8 sequences
+struct FullByte : ByteAlphabet<isFoldedByte>
+{
+    static constexpr const char *NAME = "full byte";
+};
+
+// The alphabet this build indexes with. Choose another at compile time,
+// e.g. -DTRIE_ALPHABET=AlphaNumeric; node size follows the alphabet.
+#ifndef TRIE_ALPHABET
+#define TRIE_ALPHABET LowercaseAscii
+#endif
+
+template <class Alphabet>
+struct BasicTrieNode
+{
+    BasicTrieNode *children[Alphabet::SIZE]; // Use array instead of unordered_map
+    bool isEndOfWord;
+    char word[MAX_WORD_LENGTH]; // Use char array instead of string for better memory management
+    vector<FileInfo> fileInfo;  // Resident postings; empty while they live in the postings file
+    int fileInfoCount;          // Documents containing the word, kept even when spilled
+    long long termFrequency;    // Occurrences across all documents
+    long long postingsOffset;   // Record offset in the postings file, or -1 when resident
+
+    BasicTrieNode() : isEndOfWord(false), fileInfoCount(0), termFrequency(0), postingsOffset(-1)
     {
-        if (!node)
-            return;
-        for (int i = 0; i < ALPHABET_SIZE; i++)
+        for (int i = 0; i < Alphabet::SIZE; i++)
         {
-            destroyTrie(node->children[i]);
+            children[i] = nullptr;
         }
-        delete node;
+        memset(word, 0, sizeof(word));
+    }
+};
+
+using Trie = BasicTrie<TRIE_ALPHABET>;
+using TrieNode = BasicTrieNode<TRIE_ALPHABET>;
+
+void processFile(const string &filename, Trie &trie);
+
+const char *const POSTINGS_FILE = "index.postings";
+const int POSTINGS_BLOCK_SIZE = 128; // Postings per compressed block / skip entry
+
+// StreamVByte integer coding: a control byte holds the byte lengths (1-4)
+// of four values, and the value bytes follow in one separate stream, so a
+// decoder can expand four values with one shuffle (SSSE3) or a short loop.
+namespace StreamVByte
+{
+    inline int byteLength(uint32_t value)
+    {
+        return value < (1u << 8) ? 1 : value < (1u << 16) ? 2 : value < (1u << 24) ? 3 : 4;
     }
 
-    void collectWords(TrieNode *node, char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH], int &suggestionCount)
+    // Append n values: ceil(n/4) control bytes, then the data bytes
+    inline void encode(const uint32_t *values, size_t n, vector<uint8_t> &out)
     {
-        if (node->isEndOfWord)
+        size_t control = out.size();
+        out.resize(out.size() + (n + 3) / 4, 0);
+        for (size_t i = 0; i < n; i++)
         {
-            strncpy(suggestions[suggestionCount++], node->word, MAX_WORD_LENGTH);
+            int length = byteLength(values[i]);
+            out[control + i / 4] |= (length - 1) << ((i % 4) * 2);
+            for (int b = 0; b < length; b++)
+                out.push_back(values[i] >> (8 * b));
         }
+    }
 
-        for (int i = 0; i < ALPHABET_SIZE; i++)
+#ifdef __SSSE3__
+    struct ShuffleTables
+    {
+        alignas(16) uint8_t masks[256][16];
+        uint8_t lengths[256];
+
+        ShuffleTables()
         {
-            if (node->children[i])
+            for (int control = 0; control < 256; control++)
             {
-                collectWords(node->children[i], suggestions, suggestionCount);
+                int source = 0;
+                for (int k = 0; k < 4; k++)
+                {
+                    int length = ((control >> (k * 2)) & 3) + 1;
+                    for (int b = 0; b < 4; b++)
+                        masks[control][k * 4 + b] = b < length ? source + b : 0x80;
+                    source += length;
+                }
+                lengths[control] = source;
             }
         }
+    };
+
+    inline const ShuffleTables &shuffleTables()
+    {
+        static const ShuffleTables tables;
+        return tables;
     }
+#endif
 
-    int findFileId(const char *filename)
+    // Decode n values written by encode. end bounds the readable memory, so
+    // the 16-byte vector loads never run past it. Returns the byte after
+    // the data stream.
+    inline const uint8_t *decode(const uint8_t *in, size_t n, uint32_t *out, const uint8_t *end)
     {
-        for (int i = 0; i < fileListCount; i++)
+        const uint8_t *control = in;
+        const uint8_t *data = in + (n + 3) / 4;
+        size_t i = 0;
+#ifdef __SSSE3__
+        const ShuffleTables &tables = shuffleTables();
+        for (; i + 4 <= n && end - data >= 16; i += 4)
         {
-            if (strcmp(fileList[i], filename) == 0)
-            {
-                return i;
-            }
+            uint8_t c = control[i / 4];
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+            __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i *>(tables.masks[c]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_shuffle_epi8(bytes, mask));
+            data += tables.lengths[c];
         }
-        return -1;
+#else
+        (void)end;
+#endif
+        for (; i < n; i++)
+        {
+            int length = ((control[i / 4] >> ((i % 4) * 2)) & 3) + 1;
+            uint32_t value = 0;
+            for (int b = 0; b < length; b++)
+                value |= static_cast<uint32_t>(data[b]) << (8 * b);
+            out[i] = value;
+            data += length;
+        }
+        return data;
     }
+}
+
+// Compressed postings record: doc ids (delta coded), frequencies and
+// position counts in StreamVByte blocks of POSTINGS_BLOCK_SIZE, each with a
+// skip entry (last doc id, byte offset) so a search can jump to the block
+// that may hold a doc without decoding the ones before it. Positions follow
+// in one stream, delta coded within each document.
+//
+// Layout (uint32 fields): count, blockCount, positionsOffset,
+// skip[blockCount] = {lastDoc, offset}, blocks..., positions.
+// Offsets are relative to the start of the record.
+class CompressedPostings
+{
+public:
+    static const int HEADER_WORDS = 3;
 
-    int findFileIdInFileInfo(TrieNode *node, int fileId)
+    // Postings must be sorted by fileId
+    static void encode(const vector<FileInfo> &postings, vector<uint8_t> &out)
     {
-        for (int i = 0; i < node->fileInfoCount; i++)
+        size_t start = out.size();
+        uint32_t count = postings.size();
+        uint32_t blockCount = (count + POSTINGS_BLOCK_SIZE - 1) / POSTINGS_BLOCK_SIZE;
+        out.resize(start + (HEADER_WORDS + 2 * blockCount) * sizeof(uint32_t));
+        auto setWord = [&](size_t index, uint32_t value)
+        {
+            memcpy(&out[start + index * sizeof(uint32_t)], &value, sizeof(value));
+        };
+        setWord(0, count);
+        setWord(1, blockCount);
+
+        uint32_t docs[POSTINGS_BLOCK_SIZE], freqs[POSTINGS_BLOCK_SIZE], positionCounts[POSTINGS_BLOCK_SIZE];
+        uint32_t previous = 0;
+        for (uint32_t b = 0; b < blockCount; b++)
         {
-            if (node->fileInfo[i].fileId == fileId)
+            uint32_t first = b * POSTINGS_BLOCK_SIZE;
+            uint32_t n = min<uint32_t>(POSTINGS_BLOCK_SIZE, count - first);
+            for (uint32_t i = 0; i < n; i++)
             {
-                return i;
+                const FileInfo &info = postings[first + i];
+                docs[i] = info.fileId - previous;
+                previous = info.fileId;
+                freqs[i] = info.frequency;
+                positionCounts[i] = info.positionCount;
             }
+            setWord(HEADER_WORDS + 2 * b, previous);
+            setWord(HEADER_WORDS + 2 * b + 1, out.size() - start);
+            StreamVByte::encode(docs, n, out);
+            StreamVByte::encode(freqs, n, out);
+            StreamVByte::encode(positionCounts, n, out);
         }
-        return -1;
+
+        setWord(2, out.size() - start);
+        vector<uint32_t> deltas;
+        for (const FileInfo &info : postings)
+        {
+            uint32_t last = 0;
+            for (int i = 0; i < info.positionCount; i++)
+            {
+                // Unsigned wraparound keeps this lossless even if out of order
+                deltas.push_back(static_cast<uint32_t>(info.positions[i]) - last);
+                last = info.positions[i];
+            }
+        }
+        StreamVByte::encode(deltas.data(), deltas.size(), out);
     }
 
-    // Calculate Levenshtein distance (edit distance) for spell checking
-    int editDistance(const char *s1, const char *s2)
+    // Read-only view of one encoded record
+    class Reader
     {
-        int len1 = strlen(s1);
-        int len2 = strlen(s2);
+    private:
+        const uint8_t *record;
+        const uint8_t *end; // Readable limit, for the vector decoder
 
-        // Create a 2D array to store distances
-        // We only need two rows, the current and previous
-        int dp[2][MAX_WORD_LENGTH + 1];
+        uint32_t word(size_t index) const
+        {
+            uint32_t value;
+            memcpy(&value, record + index * sizeof(uint32_t), sizeof(value));
+            return value;
+        }
 
-        // Initialize the first row
-        for (int j = 0; j <= len2; j++)
+    public:
+        Reader(const uint8_t *record, const uint8_t *end) : record(record), end(end) {}
+
+        uint32_t size() const
         {
-            dp[0][j] = j;
+            return word(0);
         }
 
-        // Fill the dp table
-        for (int i = 1; i <= len1; i++)
+        uint32_t blockCount() const
         {
-            for (int j = 0; j <= len2; j++)
+            return word(1);
+        }
+
+        uint32_t lastDoc(uint32_t block) const
+        {
+            return word(HEADER_WORDS + 2 * block);
+        }
+
+        // Bytes of the doc id / frequency part, i.e. without positions
+        uint32_t docBytes() const
+        {
+            return word(2);
+        }
+
+        // Decode block b; freqs and positionCounts may be null. Returns its length.
+        uint32_t decodeBlock(uint32_t b, uint32_t *docs, uint32_t *freqs = nullptr, uint32_t *positionCounts = nullptr) const
+        {
+            uint32_t n = min<uint32_t>(POSTINGS_BLOCK_SIZE, size() - b * POSTINGS_BLOCK_SIZE);
+            const uint8_t *in = record + word(HEADER_WORDS + 2 * b + 1);
+            in = StreamVByte::decode(in, n, docs, end);
+            uint32_t doc = b > 0 ? lastDoc(b - 1) : 0;
+            for (uint32_t i = 0; i < n; i++)
             {
-                if (j == 0)
+                doc += docs[i];
+                docs[i] = doc;
+            }
+            if (freqs || positionCounts)
+            {
+                uint32_t scratch[POSTINGS_BLOCK_SIZE];
+                in = StreamVByte::decode(in, n, freqs ? freqs : scratch, end);
+                if (positionCounts)
+                    StreamVByte::decode(in, n, positionCounts, end);
+            }
+            return n;
+        }
+
+        void decodeDocs(vector<uint32_t> &docs) const
+        {
+            docs.resize(size());
+            for (uint32_t b = 0; b < blockCount(); b++)
+                decodeBlock(b, docs.data() + b * POSTINGS_BLOCK_SIZE);
+        }
+
+        void decode(vector<FileInfo> &postings) const
+        {
+            uint32_t count = size();
+            postings.resize(count);
+            uint32_t docs[POSTINGS_BLOCK_SIZE], freqs[POSTINGS_BLOCK_SIZE], positionCounts[POSTINGS_BLOCK_SIZE];
+            size_t totalPositions = 0;
+            for (uint32_t b = 0; b < blockCount(); b++)
+            {
+                uint32_t n = decodeBlock(b, docs, freqs, positionCounts);
+                for (uint32_t i = 0; i < n; i++)
                 {
-                    dp[i % 2][j] = i;
+                    FileInfo &info = postings[b * POSTINGS_BLOCK_SIZE + i];
+                    info.fileId = docs[i];
+                    info.frequency = freqs[i];
+                    info.positionCount = positionCounts[i];
+                    totalPositions += positionCounts[i];
                 }
-                else if (s1[i - 1] == s2[j - 1])
+            }
+
+            vector<uint32_t> deltas(totalPositions);
+            StreamVByte::decode(record + docBytes(), totalPositions, deltas.data(), end);
+            size_t next = 0;
+            for (FileInfo &info : postings)
+            {
+                uint32_t position = 0;
+                for (int i = 0; i < info.positionCount; i++)
                 {
-                    dp[i % 2][j] = dp[(i - 1) % 2][j - 1];
+                    position += deltas[next++];
+                    info.positions[i] = position;
                 }
-                else
+            }
+        }
+
+        // Keep the candidates (sorted) that are in this list. Blocks whose
+        // last doc is below the next candidate are skipped undecoded.
+        void intersect(const vector<uint32_t> &candidates, vector<uint32_t> &out) const
+        {
+            out.clear();
+            uint32_t docs[POSTINGS_BLOCK_SIZE];
+            uint32_t blocks = blockCount();
+            uint32_t block = 0, decoded = UINT32_MAX, n = 0, i = 0;
+            for (uint32_t candidate : candidates)
+            {
+                while (block < blocks && lastDoc(block) < candidate)
+                    block++;
+                if (block == blocks)
+                    break;
+                if (decoded != block)
                 {
-                    dp[i % 2][j] = 1 + min(
-                                           dp[(i - 1) % 2][j], // Delete
-                                           min(
-                                               dp[i % 2][j - 1],      // Insert
-                                               dp[(i - 1) % 2][j - 1] // Replace
-                                               ));
+                    n = decodeBlock(block, docs);
+                    decoded = block;
+                    i = 0;
                 }
+                while (i < n && docs[i] < candidate)
+                    i++;
+                if (i < n && docs[i] == candidate)
+                    out.push_back(candidate);
             }
         }
+    };
 
-        return dp[len1 % 2][len2];
-    }
-
-    void findAllWords(TrieNode *node, char allWords[MAX_SUGGESTIONS][MAX_WORD_LENGTH], int &count)
+    // Docs in every list, decoding the shortest block-at-a-time and probing
+    // the others through their skip entries
+    static void intersect(vector<Reader> lists, vector<uint32_t> &out)
     {
-        if (!node)
+        out.clear();
+        if (lists.empty())
             return;
+        sort(lists.begin(), lists.end(), [](const Reader &a, const Reader &b)
+             { return a.size() < b.size(); });
+        lists[0].decodeDocs(out);
+        vector<uint32_t> next;
+        for (size_t l = 1; l < lists.size() && !out.empty(); l++)
+        {
+            lists[l].intersect(out, next);
+            out.swap(next);
+        }
+    }
 
-        if (node->isEndOfWord && count < MAX_SUGGESTIONS)
+    // Docs in any list, merging decoded blocks
+    static void unite(const vector<Reader> &lists, vector<uint32_t> &out)
+    {
+        out.clear();
+        vector<uint32_t> docs, merged;
+        for (const Reader &list : lists)
         {
-            strncpy(allWords[count++], node->word, MAX_WORD_LENGTH);
+            list.decodeDocs(docs);
+            merged.clear();
+            set_union(out.begin(), out.end(), docs.begin(), docs.end(), back_inserter(merged));
+            out.swap(merged);
         }
+    }
+};
+
+const int DOCSET_ARRAY_MAX = 4096;       // Larger containers switch to a bitmap
+const int DOCSET_BITMAP_WORDS = 1024;    // 65536 bits per container
+const int FREQUENT_TERM_DOCUMENTS = 64;  // Terms in this many documents get a cached DocSet
+
+// Roaring-style compressed document set. Doc ids are split by their high 16
+// bits into containers, each stored as whichever is smallest: a sorted array
+// (sparse), a 65536-bit bitmap (dense) or a list of runs (ranges). Set
+// operations work container by container; bitmap pairs are combined a word
+// vector at a time.
+class DocSet
+{
+private:
+    enum Kind : uint8_t
+    {
+        ARRAY,
+        BITMAP,
+        RUN
+    };
+    enum Op
+    {
+        AND,
+        OR,
+        ANDNOT
+    };
+
+    struct Container
+    {
+        uint16_t key = 0;
+        Kind kind = ARRAY;
+        vector<uint16_t> values; // ARRAY: sorted values; RUN: (start, length - 1) pairs
+        vector<uint64_t> words;  // BITMAP
+        uint32_t cardinality = 0;
+    };
+
+    vector<Container> containers; // Sorted by key
 
-        for (int i = 0; i < ALPHABET_SIZE; i++)
+    static bool containerContains(const Container &c, uint16_t low)
+    {
+        switch (c.kind)
         {
-            if (node->children[i])
+        case ARRAY:
+            return binary_search(c.values.begin(), c.values.end(), low);
+        case BITMAP:
+            return (c.words[low >> 6] >> (low & 63)) & 1;
+        default:
+            for (size_t i = 0; i < c.values.size() && c.values[i] <= low; i += 2)
             {
-                findAllWords(node->children[i], allWords, count);
-                if (count >= MAX_SUGGESTIONS)
-                    break;
+                if (low <= c.values[i] + c.values[i + 1])
+                    return true;
             }
+            return false;
         }
     }
 
-public:
-    Trie() : fileListCount(0)
+    // The container's bits, using buffer unless it already is a bitmap
+    static const uint64_t *bitmapOf(const Container &c, vector<uint64_t> &buffer)
     {
-        root = new TrieNode();
+        if (c.kind == BITMAP)
+            return c.words.data();
+        buffer.assign(DOCSET_BITMAP_WORDS, 0);
+        if (c.kind == ARRAY)
+        {
+            for (uint16_t v : c.values)
+                buffer[v >> 6] |= 1ULL << (v & 63);
+        }
+        else
+        {
+            for (size_t i = 0; i < c.values.size(); i += 2)
+            {
+                for (uint32_t v = c.values[i]; v <= static_cast<uint32_t>(c.values[i] + c.values[i + 1]); v++)
+                    buffer[v >> 6] |= 1ULL << (v & 63);
+            }
+        }
+        return buffer.data();
     }
 
-    ~Trie()
+    static void combineWords(Op op, const uint64_t *a, const uint64_t *b, uint64_t *out)
     {
-        destroyTrie(root);
+        int i = 0;
+#ifdef __SSE2__
+        for (; i + 2 <= DOCSET_BITMAP_WORDS; i += 2)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i r = op == AND ? _mm_and_si128(x, y) : op == OR ? _mm_or_si128(x, y) : _mm_andnot_si128(y, x);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), r);
+        }
+#endif
+        for (; i < DOCSET_BITMAP_WORDS; i++)
+            out[i] = op == AND ? a[i] & b[i] : op == OR ? a[i] | b[i] : a[i] & ~b[i];
     }
 
-    // Improved stemming algorithm
-    void stem(char *word)
+    static bool fromArray(uint16_t key, vector<uint16_t> &values, Container &out)
     {
-        int length = strlen(word);
-
-        // Basic Porter stemming algorithm (simplified)
-        if (length > 3)
+        if (values.empty())
+            return false;
+        out.key = key;
+        out.cardinality = values.size();
+        if (values.size() <= static_cast<size_t>(DOCSET_ARRAY_MAX))
         {
-            // Handle -ing suffix
-            if (strcmp(word + length - 3, "ing") == 0)
-            {
-                word[length - 3] = '\0';
-                // If word ends with double letter after removing 'ing', remove one
-                length = strlen(word);
-                if (length >= 2 && word[length - 1] == word[length - 2])
-                {
-                    word[length - 1] = '\0';
-                }
-            }
-            // Handle -ed suffix
-            else if (length > 2 && strcmp(word + length - 2, "ed") == 0)
-            {
-                word[length - 2] = '\0';
-                // If word ends with double letter after removing 'ed', remove one
-                length = strlen(word);
-                if (length >= 2 && word[length - 1] == word[length - 2])
-                {
-                    word[length - 1] = '\0';
-                }
-            }
-            // Handle -ies suffix (plurals like "stories" -> "story")
-            else if (length > 3 && strcmp(word + length - 3, "ies") == 0)
-            {
-                word[length - 3] = 'y';
-                word[length - 2] = '\0';
-            }
-            // Handle -es suffix
-            else if (length > 2 && strcmp(word + length - 2, "es") == 0)
-            {
-                word[length - 2] = '\0';
-            }
-            // Handle regular plural -s
-            else if (length > 1 && word[length - 1] == 's' &&
-                     word[length - 2] != 's' && word[length - 2] != 'i')
-            {
-                word[length - 1] = '\0';
-            }
+            out.kind = ARRAY;
+            out.values.swap(values);
+            return true;
         }
+        out.kind = BITMAP;
+        out.words.assign(DOCSET_BITMAP_WORDS, 0);
+        for (uint16_t v : values)
+            out.words[v >> 6] |= 1ULL << (v & 63);
+        return true;
     }
 
-    bool isStopWord(const char *word)
+    static bool fromBitmap(uint16_t key, vector<uint64_t> &words, Container &out)
     {
-        const char *stopWords[] = {"the", "a", "is", "of", "and", "in", "to", "it", "that", "for"};
-        for (int i = 0; i < 10; i++)
+        uint32_t cardinality = 0;
+        for (uint64_t w : words)
+            cardinality += __builtin_popcountll(w);
+        if (cardinality == 0)
+            return false;
+        out.key = key;
+        out.cardinality = cardinality;
+        if (cardinality > static_cast<uint32_t>(DOCSET_ARRAY_MAX))
         {
-            if (strcmp(stopWords[i], word) == 0)
-            {
-                return true;
-            }
+            out.kind = BITMAP;
+            out.words.swap(words);
+            return true;
         }
-        return false;
+        out.kind = ARRAY;
+        out.values.clear();
+        for (int i = 0; i < DOCSET_BITMAP_WORDS; i++)
+        {
+            for (uint64_t w = words[i]; w; w &= w - 1)
+                out.values.push_back(i * 64 + __builtin_ctzll(w));
+        }
+        return true;
     }
 
-    void insert(const char *word, int fileId)
+    static void arrayOf(const Container &c, vector<uint16_t> &values)
     {
-        TrieNode *current = root;
+        values.clear();
+        if (c.kind == ARRAY)
+        {
+            values = c.values;
+            return;
+        }
+        vector<uint64_t> buffer;
+        const uint64_t *words = bitmapOf(c, buffer);
+        for (int i = 0; i < DOCSET_BITMAP_WORDS; i++)
+        {
+            for (uint64_t w = words[i]; w; w &= w - 1)
+                values.push_back(i * 64 + __builtin_ctzll(w));
+        }
+    }
 
-        for (int i = 0; word[i]; i++)
+    static bool combineContainers(Op op, const Container &x, const Container &y, Container &out)
+    {
+        vector<uint16_t> values;
+        if (x.kind == ARRAY && y.kind == ARRAY)
+        {
+            if (op == AND)
+                set_intersection(x.values.begin(), x.values.end(), y.values.begin(), y.values.end(), back_inserter(values));
+            else if (op == OR)
+                set_union(x.values.begin(), x.values.end(), y.values.begin(), y.values.end(), back_inserter(values));
+            else
+                set_difference(x.values.begin(), x.values.end(), y.values.begin(), y.values.end(), back_inserter(values));
+            return fromArray(x.key, values, out);
+        }
+
+        // A sparse side only needs membership tests against the other
+        if ((op == AND || op == ANDNOT) && x.kind == ARRAY)
         {
-            char ch = tolower(word[i]);
-            if (!isalpha(ch))
+            for (uint16_t v : x.values)
             {
-                continue;
+                if (containerContains(y, v) == (op == AND))
+                    values.push_back(v);
             }
-            int index = ch - 'a';
-            if (!current->children[index])
+            return fromArray(x.key, values, out);
+        }
+        if (op == AND && y.kind == ARRAY)
+        {
+            for (uint16_t v : y.values)
             {
-                current->children[index] = new TrieNode();
-                if (current->children[index] == nullptr)
-                {
-                    cerr << "Memory allocation failed!" << endl;
-                    exit(1);
-                }
+                if (containerContains(x, v))
+                    values.push_back(v);
             }
-            current = current->children[index];
+            return fromArray(x.key, values, out);
         }
 
-        current->isEndOfWord = true;
-        if (strlen(current->word) == 0)
+        vector<uint64_t> bufferX, bufferY, words(DOCSET_BITMAP_WORDS);
+        combineWords(op, bitmapOf(x, bufferX), bitmapOf(y, bufferY), words.data());
+        return fromBitmap(x.key, words, out);
+    }
+
+    static DocSet combine(Op op, const DocSet &a, const DocSet &b)
+    {
+        DocSet result;
+        size_t i = 0, j = 0;
+        while (i < a.containers.size() || j < b.containers.size())
         {
-            strncpy(current->word, word, MAX_WORD_LENGTH);
+            bool takeA = j == b.containers.size() || (i < a.containers.size() && a.containers[i].key < b.containers[j].key);
+            bool takeB = i == a.containers.size() || (j < b.containers.size() && b.containers[j].key < a.containers[i].key);
+            if (takeA)
+            {
+                if (op != AND)
+                    result.containers.push_back(a.containers[i]);
+                i++;
+            }
+            else if (takeB)
+            {
+                if (op == OR)
+                    result.containers.push_back(b.containers[j]);
+                j++;
+            }
+            else
+            {
+                Container c;
+                if (combineContainers(op, a.containers[i], b.containers[j], c))
+                    result.containers.push_back(move(c));
+                i++;
+                j++;
+            }
         }
+        return result;
+    }
 
-        int fileIndex = findFileIdInFileInfo(current, fileId);
-        if (fileIndex == -1)
+public:
+    // Build from sorted, unique doc ids
+    static DocSet fromSorted(const vector<uint32_t> &docs)
+    {
+        DocSet set;
+        vector<uint16_t> values;
+        for (size_t i = 0; i < docs.size();)
         {
-            current->fileInfo[current->fileInfoCount++] = {fileId, 1};
+            uint16_t key = docs[i] >> 16;
+            values.clear();
+            for (; i < docs.size() && (docs[i] >> 16) == key; i++)
+                values.push_back(docs[i] & 0xFFFF);
+            Container c;
+            fromArray(key, values, c);
+            set.containers.push_back(move(c));
         }
-        else
+        return set;
+    }
+
+    // Every doc id in [begin, end), stored as runs
+    static DocSet range(uint32_t begin, uint32_t end)
+    {
+        DocSet set;
+        while (begin < end)
         {
-            current->fileInfo[fileIndex].frequency++;
+            uint32_t containerEnd = min<uint32_t>(end, ((begin >> 16) + 1) << 16);
+            Container c;
+            c.key = begin >> 16;
+            c.kind = RUN;
+            c.values = {static_cast<uint16_t>(begin & 0xFFFF), static_cast<uint16_t>(containerEnd - begin - 1)};
+            c.cardinality = containerEnd - begin;
+            set.containers.push_back(move(c));
+            begin = containerEnd;
         }
+        return set;
     }
 
-    bool search(const char *word)
+    void add(uint32_t doc)
     {
-        char wordCopy[MAX_WORD_LENGTH];
-        strncpy(wordCopy, word, MAX_WORD_LENGTH);
+        uint16_t key = doc >> 16, low = doc & 0xFFFF;
+        auto it = lower_bound(containers.begin(), containers.end(), key, [](const Container &c, uint16_t k)
+                              { return c.key < k; });
+        if (it == containers.end() || it->key != key)
+        {
+            Container c;
+            c.key = key;
+            c.kind = ARRAY;
+            c.values = {low};
+            c.cardinality = 1;
+            containers.insert(it, move(c));
+            return;
+        }
+        if (containerContains(*it, low))
+            return;
 
-        // Apply stemming to the search word
-        stem(wordCopy);
+        vector<uint16_t> values;
+        arrayOf(*it, values);
+        values.insert(lower_bound(values.begin(), values.end(), low), low);
+        Container c;
+        fromArray(key, values, c);
+        *it = move(c);
+    }
 
-        TrieNode *current = root;
+    bool contains(uint32_t doc) const
+    {
+        uint16_t key = doc >> 16;
+        auto it = lower_bound(containers.begin(), containers.end(), key, [](const Container &c, uint16_t k)
+                              { return c.key < k; });
+        return it != containers.end() && it->key == key && containerContains(*it, doc & 0xFFFF);
+    }
 
-        for (int i = 0; wordCopy[i] != '\0'; i++)
-        {
-            char ch = tolower(wordCopy[i]);
-            if (!isalpha(ch))
-                return false;
+    static DocSet intersect(const DocSet &a, const DocSet &b)
+    {
+        return combine(AND, a, b);
+    }
 
-            int index = ch - 'a';
-            if (!current->children[index])
-            {
-                return false;
-            }
-            current = current->children[index];
-        }
+    static DocSet unite(const DocSet &a, const DocSet &b)
+    {
+        return combine(OR, a, b);
+    }
 
-        return current != nullptr && current->isEndOfWord;
+    static DocSet subtract(const DocSet &a, const DocSet &b)
+    {
+        return combine(ANDNOT, a, b);
     }
 
-    int addFile(const char *filename)
+    // Store containers as runs where that is smaller (e.g. ranges of deletes)
+    void runOptimize()
     {
-        for (int i = 0; i < fileListCount; i++)
+        vector<uint16_t> values;
+        for (Container &c : containers)
         {
-            if (strcmp(fileList[i], filename) == 0)
+            if (c.kind == RUN)
+                continue;
+            arrayOf(c, values);
+            vector<uint16_t> runs;
+            for (size_t i = 0; i < values.size();)
             {
-                return i;
+                size_t j = i;
+                while (j + 1 < values.size() && values[j + 1] == values[j] + 1)
+                    j++;
+                runs.push_back(values[i]);
+                runs.push_back(values[j] - values[i]);
+                i = j + 1;
+            }
+            size_t current = c.kind == ARRAY ? c.values.size() * 2 : DOCSET_BITMAP_WORDS * 8;
+            if (runs.size() * 2 < current)
+            {
+                c.kind = RUN;
+                c.values.swap(runs);
+                c.words.clear();
+                c.words.shrink_to_fit();
             }
         }
-        strncpy(fileList[fileListCount++], filename, MAX_WORD_LENGTH);
-        return fileListCount - 1;
     }
 
-    TrieNode *getRootNode()
+    void toVector(vector<uint32_t> &docs) const
     {
-        return root;
+        docs.clear();
+        vector<uint16_t> values;
+        for (const Container &c : containers)
+        {
+            arrayOf(c, values);
+            for (uint16_t v : values)
+                docs.push_back((static_cast<uint32_t>(c.key) << 16) | v);
+        }
     }
 
-    const char *getFilename(int fileId)
+    size_t cardinality() const
     {
-        return fileList[fileId];
+        size_t total = 0;
+        for (const Container &c : containers)
+            total += c.cardinality;
+        return total;
     }
 
-    // Get word details including file occurrences
-    void getWordDetails(const char *word, char result[MAX_RESULTS][MAX_WORD_LENGTH], int &resultCount)
+    bool empty() const
     {
-        resultCount = 0;
-        char wordCopy[MAX_WORD_LENGTH];
-        strncpy(wordCopy, word, MAX_WORD_LENGTH);
-        stem(wordCopy);
-
-        TrieNode *current = root;
-        for (int i = 0; wordCopy[i] != '\0'; i++)
-        {
-            char ch = tolower(wordCopy[i]);
-            if (!isalpha(ch))
-                return;
+        return containers.empty();
+    }
 
-            int index = ch - 'a';
-            if (!current->children[index])
-            {
-                return;
-            }
-            current = current->children[index];
-        }
+    size_t memoryBytes() const
+    {
+        size_t bytes = 0;
+        for (const Container &c : containers)
+            bytes += sizeof(Container) + c.values.capacity() * sizeof(uint16_t) + c.words.capacity() * sizeof(uint64_t);
+        return bytes;
+    }
+};
 
-        if (current && current->isEndOfWord)
-        {
-            // Format: "Original word: [stemmed form]"
-            sprintf(result[resultCount++], "Word: %s [stemmed: %s]", word, current->word);
+// Postings moved out of memory into a file that is read through a read-only
+// memory map, so only the pages of terms actually queried become resident
+// and the kernel can drop them again under memory pressure. Each term's
+// record is a CompressedPostings record.
+class PostingsFile
+{
+private:
+    const char *data = nullptr;
+    size_t size = 0;
 
-            // Format: "Total occurrences: X"
-            int totalCount = 0;
-            for (int i = 0; i < current->fileInfoCount; i++)
-            {
-                totalCount += current->fileInfo[i].frequency;
-            }
-            sprintf(result[resultCount++], "Total occurrences: %d", totalCount);
+public:
+    ~PostingsFile()
+    {
+        close();
+    }
 
-            // List occurrences by file
-            sprintf(result[resultCount++], "Occurrences by file:");
-            for (int i = 0; i < current->fileInfoCount; i++)
-            {
-                sprintf(result[resultCount++], "  - %s: %d times",
-                        fileList[current->fileInfo[i].fileId],
-                        current->fileInfo[i].frequency);
-            }
-        }
+    bool mapped() const
+    {
+        return data != nullptr;
     }
 
-    // Partial search functionality
-    bool partialSearch(const char *word, char results[MAX_RESULTS][MAX_WORD_LENGTH], int &resultCount)
+    bool open(const char *path)
     {
-        resultCount = 0;
-        char wordCopy[MAX_WORD_LENGTH];
-        strncpy(wordCopy, word, MAX_WORD_LENGTH);
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
 
-        TrieNode *current = root;
-        for (int i = 0; wordCopy[i] != '\0'; i++)
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
         {
-            char ch = tolower(wordCopy[i]);
-            if (!isalpha(ch))
-                return false;
-
-            int index = ch - 'a';
-            if (!current->children[index])
+            void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping != MAP_FAILED)
             {
-                return false;
+                data = static_cast<const char *>(mapping);
+                size = info.st_size;
+                // Lookups jump between terms, so readahead would only waste memory
+                madvise(mapping, size, MADV_RANDOM);
             }
-            current = current->children[index];
         }
+        ::close(fd);
+        return mapped();
+    }
 
-        // Now collect all words from this point in the trie
-        collectWords(current, results, resultCount);
-        return resultCount > 0;
+    void close()
+    {
+        if (data)
+            munmap(const_cast<char *>(data), size);
+        data = nullptr;
+        size = 0;
     }
 
-    // Autocomplete functionality
-    bool autocomplete(const char *prefix, char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH], int &suggestionCount)
+    // Append one record to file, sorting by fileId first; returns false on
+    // a write error
+    static bool encode(FILE *file, const vector<FileInfo> &postings)
     {
-        suggestionCount = 0;
+        vector<FileInfo> sorted(postings);
+        sort(sorted.begin(), sorted.end(), [](const FileInfo &a, const FileInfo &b)
+             { return a.fileId < b.fileId; });
+        vector<uint8_t> record;
+        CompressedPostings::encode(sorted, record);
+        return fwrite(record.data(), 1, record.size(), file) == record.size();
+    }
 
-        TrieNode *current = root;
-        for (int i = 0; prefix[i] != '\0'; i++)
-        {
-            char ch = tolower(prefix[i]);
-            if (!isalpha(ch))
-                return false;
+    CompressedPostings::Reader reader(long long offset) const
+    {
+        const uint8_t *base = reinterpret_cast<const uint8_t *>(data);
+        return CompressedPostings::Reader(base + offset, base + size);
+    }
 
-            int index = ch - 'a';
-            if (!current->children[index])
-            {
-                return false;
-            }
-            current = current->children[index];
-        }
+    void decode(long long offset, vector<FileInfo> &postings) const
+    {
+        reader(offset).decode(postings);
+    }
 
-        // Collect all words from this point in the trie
-        collectWords(current, suggestions, suggestionCount);
-        return suggestionCount > 0;
+    const uint8_t *begin() const
+    {
+        return reinterpret_cast<const uint8_t *>(data);
     }
 
-    // Advanced search with phrase matching
-    bool advancedSearch(const char *query, char results[MAX_RESULTS][MAX_WORD_LENGTH], int &resultCount)
+    size_t bytes() const
     {
-        resultCount = 0;
+        return size;
+    }
 
-        // Split the query into words
-        char queryCopy[MAX_WORD_LENGTH];
-        strncpy(queryCopy, query, MAX_WORD_LENGTH);
+    // Bytes of the mapping currently in memory
+    size_t residentBytes() const
+    {
+        if (!data)
+            return 0;
+        long page = sysconf(_SC_PAGESIZE);
+        size_t pages = (size + page - 1) / page;
+        vector<unsigned char> resident(pages);
+        if (mincore(const_cast<char *>(data), size, resident.data()) != 0)
+            return 0;
+        return count_if(resident.begin(), resident.end(), [](unsigned char r)
+                        { return r & 1; }) *
+               page;
+    }
+};
 
-        char *words[MAX_SUGGESTIONS];
-        int wordCount = 0;
+// Read-only double-array form of the trie. A child of state s on character
+// code c (1..Alphabet::SIZE) is state t = base[s] + c when check[t] == s, so
+// each step is two reads from contiguous arrays instead of a pointer chase.
+template <class Alphabet>
+class DoubleArrayTrie
+{
+private:
+    using TrieNode = BasicTrieNode<Alphabet>;
 
-        char *token = strtok(queryCopy, " ");
-        while (token != NULL && wordCount < MAX_SUGGESTIONS)
+    vector<int32_t> base;
+    vector<int32_t> check; // Parent state, or -1 for a free slot
+    vector<uint8_t> terminal;
+    vector<TrieNode *> nodes; // Source node for each state, for postings access
+
+    void ensureSize(size_t size)
+    {
+        if (size > check.size())
         {
-            words[wordCount++] = token;
-            token = strtok(NULL, " ");
+            size_t newSize = max(size, check.size() * 2);
+            base.resize(newSize, 0);
+            check.resize(newSize, -1);
+            terminal.resize(newSize, 0);
+            nodes.resize(newSize, nullptr);
         }
+    }
 
-        // For advanced search, we'll implement a basic AND search (all terms must be present)
-        if (wordCount == 0)
-            return false;
+public:
+    bool built() const
+    {
+        return !check.empty();
+    }
 
-        // First, find file occurrences for the first word
-        int fileMatches[MAX_FILES] = {0}; // Track matched files
+    void clear()
+    {
+        base.clear();
+        check.clear();
+        terminal.clear();
+        nodes.clear();
+    }
 
-        for (int w = 0; w < wordCount; w++)
+    void build(TrieNode *root)
+    {
+        clear();
+        ensureSize(Alphabet::SIZE + 2);
+        check[0] = 0; // Root
+        nodes[0] = root;
+        terminal[0] = root->isEndOfWord;
+
+        // Breadth first so sibling groups are placed near their parents
+        vector<pair<TrieNode *, int32_t>> queue;
+        queue.push_back({root, 0});
+        size_t firstFree = 1;
+        int codes[Alphabet::SIZE];
+
+        for (size_t q = 0; q < queue.size(); q++)
         {
-            char *word = words[w];
-            stem(word);
+            TrieNode *node = queue[q].first;
+            int32_t state = queue[q].second;
+
+            int codeCount = 0;
+            for (int i = 0; i < Alphabet::SIZE; i++)
+            {
+                if (node->children[i])
+                    codes[codeCount++] = i + 1;
+            }
+            if (codeCount == 0)
+                continue;
 
-            TrieNode *current = root;
-            // This is the fixed loop condition
-            for (int i = 0; word[i] != '\0'; i++)
+            // First base whose slots for every child code are free, scanning
+            // free slots for the first code from the first known free slot
+            size_t pos = max(firstFree, static_cast<size_t>(codes[0] + 1)) - 1;
+            size_t occupied = 0;
+            size_t firstCandidate = 0;
+            int32_t b;
+            while (true)
             {
-                char ch = tolower(word[i]);
-                if (!isalpha(ch))
+                pos++;
+                ensureSize(pos + 1);
+                if (check[pos] != -1)
+                {
+                    occupied++;
                     continue;
+                }
+                if (firstCandidate == 0)
+                    firstCandidate = pos;
 
-                int index = ch - 'a';
-                if (!current->children[index])
+                b = pos - codes[0];
+                ensureSize(b + codes[codeCount - 1] + 1);
+                bool fits = true;
+                for (int k = 1; k < codeCount && fits; k++)
                 {
-                    // Word doesn't exist, so no matches
-                    return false;
+                    fits = check[b + codes[k]] == -1;
                 }
-                current = current->children[index];
+                if (fits)
+                    break;
             }
 
-            if (!current->isEndOfWord)
-            {
-                // Word doesn't exist
-                return false;
-            }
+            // Skip past regions that are nearly full so later scans stay short
+            if (occupied >= 0.95 * (pos - firstCandidate + 1))
+                firstFree = pos;
+            else
+                firstFree = firstCandidate;
 
-            // Mark files that contain this word
-            for (int i = 0; i < current->fileInfoCount; i++)
+            base[state] = b;
+            for (int k = 0; k < codeCount; k++)
             {
-                int fileId = current->fileInfo[i].fileId;
-                if (w == 0 || fileMatches[fileId] == w)
-                {
-                    fileMatches[fileId]++;
-                }
+                int32_t child = b + codes[k];
+                TrieNode *childNode = node->children[codes[k] - 1];
+                check[child] = state;
+                terminal[child] = childNode->isEndOfWord;
+                nodes[child] = childNode;
+                queue.push_back({childNode, child});
             }
         }
 
-        // Check which files contain all words
-        for (int i = 0; i < MAX_FILES; i++)
+        // Trim unused tail slots
+        size_t used = check.size();
+        while (used > 1 && check[used - 1] == -1)
+            used--;
+        base.resize(used);
+        check.resize(used);
+        terminal.resize(used);
+        nodes.resize(used);
+    }
+
+    // State reached by key, or -1 if the path does not exist
+    int32_t walk(const char *key) const
+    {
+        int32_t state = 0;
+        int32_t size = check.size();
+        for (int i = 0; key[i] != '\0'; i++)
         {
-            if (fileMatches[i] == wordCount)
-            {
-                // This file contains all words
-                sprintf(results[resultCount++], "%s", fileList[i]);
-                if (resultCount >= MAX_RESULTS)
-                    break;
-            }
+            int slot = Alphabet::slot(key[i]);
+            if (slot < 0)
+                return -1;
+
+            int32_t next = base[state] + (slot + 1);
+            if (next >= size || check[next] != state)
+                return -1;
+            state = next;
         }
-
-        return resultCount > 0;
+        return state;
     }
 
-    // Find words similar to the misspelled word
-    bool spellCheck(const char *word, char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH], int &suggestionCount)
+    TrieNode *nodeAt(int32_t state) const
     {
-        suggestionCount = 0;
+        return nodes[state];
+    }
 
-        // Get all words in the dictionary
-        char allWords[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
-        int wordCount = 0;
-        findAllWords(root, allWords, wordCount);
+    size_t slotCount() const
+    {
+        return check.size();
+    }
 
-        // Create an array to store words with their edit distances
-        struct WordDistance
-        {
-            char word[MAX_WORD_LENGTH];
-            int distance;
-        };
+    size_t usedSlots() const
+    {
+        return count_if(check.begin(), check.end(), [](int32_t c)
+                        { return c != -1; });
+    }
 
-        WordDistance distances[MAX_SUGGESTIONS];
-        int distanceCount = 0;
+    // Bytes of the base/check/terminal arrays, i.e. the on-disk image
+    size_t arrayBytes() const
+    {
+        return check.size() * (sizeof(int32_t) * 2 + sizeof(uint8_t));
+    }
 
-        // Calculate edit distance for each word
-        for (int i = 0; i < wordCount; i++)
-        {
-            int distance = editDistance(word, allWords[i]);
-            if (distance <= MAX_EDIT_DISTANCE)
-            {
-                strncpy(distances[distanceCount].word, allWords[i], MAX_WORD_LENGTH);
-                distances[distanceCount].distance = distance;
-                distanceCount++;
+    // Write the arrays as-is: magic, slot count, base[], check[], terminal[]
+    bool save(const char *filename) const
+    {
+        FILE *file = fopen(filename, "wb");
+        if (!file)
+            return false;
 
-                if (distanceCount >= MAX_SUGGESTIONS)
-                    break;
+        uint32_t size = check.size();
+        bool ok = fwrite("DATRIE01", 1, 8, file) == 8 &&
+                  fwrite(&size, sizeof(size), 1, file) == 1 &&
+                  fwrite(base.data(), sizeof(int32_t), size, file) == size &&
+                  fwrite(check.data(), sizeof(int32_t), size, file) == size &&
+                  fwrite(terminal.data(), sizeof(uint8_t), size, file) == size;
+        return fclose(file) == 0 && ok;
+    }
+};
+
+// Frozen, cache-conscious copy of the trie's branching structure. Each node
+// is 16 bytes for alphabets of up to 32 characters (the mask grows by a word
+// per 32 more) and its children are stored as one contiguous group, addressed
+// by popcount over a child bitmask. Groups are laid out in blocks: a block is
+// blockDepth levels placed breadth first, and the subtrees hanging below a
+// block follow it heaviest first (by total term frequency), so hot descents
+// stay in a few adjacent cache lines (a van Emde Boas-style blocking). A
+// blockDepth of 0 places the whole trie breadth first.
+template <class Alphabet>
+class PackedTrie
+{
+private:
+    using TrieNode = BasicTrieNode<Alphabet>;
+    static const int MASK_WORDS = (Alphabet::SIZE + 31) / 32;
+
+    struct PackedNode
+    {
+        uint32_t childMask[MASK_WORDS];
+        int32_t firstChild; // Index of the child group, -1 for a leaf
+        TrieNode *node;     // Source node, for postings access
+    };
+
+    vector<PackedNode> nodes; // nodes[0] is the root
+    int layoutBlockDepth = 0;
+
+    static uint64_t subtreeWeight(TrieNode *node, unordered_map<TrieNode *, uint64_t> &weights)
+    {
+        uint64_t weight = node->termFrequency;
+        for (int i = 0; i < Alphabet::SIZE; i++)
+        {
+            if (node->children[i])
+                weight += subtreeWeight(node->children[i], weights);
+        }
+        weights[node] = weight;
+        return weight;
+    }
+
+    // Give nodes[index] its child group at the end of the array
+    void placeChildren(int32_t index, vector<int32_t> &placed)
+    {
+        TrieNode *node = nodes[index].node;
+        bool leaf = true;
+        for (int i = 0; i < Alphabet::SIZE; i++)
+        {
+            if (node->children[i])
+            {
+                nodes[index].childMask[i / 32] |= 1u << (i % 32);
+                leaf = false;
             }
         }
+        if (leaf)
+            return;
 
-        // Sort by distance (simple bubble sort)
-        for (int i = 0; i < distanceCount - 1; i++)
+        nodes[index].firstChild = nodes.size();
+        for (int i = 0; i < Alphabet::SIZE; i++)
         {
-            for (int j = 0; j < distanceCount - i - 1; j++)
+            if (node->children[i])
             {
-                if (distances[j].distance > distances[j + 1].distance)
-                {
-                    WordDistance temp = distances[j];
-                    distances[j] = distances[j + 1];
-                    distances[j + 1] = temp;
-                }
+                placed.push_back(nodes.size());
+                nodes.push_back({{}, -1, node->children[i]});
             }
         }
+    }
 
-        // Copy suggestions
-        suggestionCount = distanceCount;
-        for (int i = 0; i < distanceCount; i++)
+    void placeBlock(int32_t blockRoot, const unordered_map<TrieNode *, uint64_t> &weights)
+    {
+        vector<int32_t> frontier{blockRoot};
+        for (int level = 0; level < layoutBlockDepth && !frontier.empty(); level++)
         {
-            strncpy(suggestions[i], distances[i].word, MAX_WORD_LENGTH);
+            vector<int32_t> next;
+            for (int32_t index : frontier)
+                placeChildren(index, next);
+            frontier.swap(next);
         }
 
-        return suggestionCount > 0;
+        // Subtrees below the block, hottest first
+        sort(frontier.begin(), frontier.end(), [&](int32_t a, int32_t b)
+             { return weights.at(nodes[a].node) > weights.at(nodes[b].node); });
+        for (int32_t index : frontier)
+            placeBlock(index, weights);
     }
 
-    // Word proximity search
-    bool proximitySearch(const char *word1, const char *word2, int maxDistance,
-                         char results[MAX_RESULTS][MAX_WORD_LENGTH], int &resultCount)
+public:
+    bool built() const
     {
-        resultCount = 0;
+        return !nodes.empty();
+    }
 
-        char stemmed1[MAX_WORD_LENGTH];
-        char stemmed2[MAX_WORD_LENGTH];
+    void clear()
+    {
+        nodes.clear();
+    }
 
-        strncpy(stemmed1, word1, MAX_WORD_LENGTH);
-        strncpy(stemmed2, word2, MAX_WORD_LENGTH);
+    void build(TrieNode *root, int blockDepth)
+    {
+        clear();
+        layoutBlockDepth = blockDepth;
+        nodes.push_back({{}, -1, root});
+        if (blockDepth <= 0)
+        {
+            // Plain breadth-first order
+            vector<int32_t> queue{0};
+            for (size_t q = 0; q < queue.size(); q++)
+                placeChildren(queue[q], queue);
+            return;
+        }
 
-        stem(stemmed1);
-        stem(stemmed2);
+        unordered_map<TrieNode *, uint64_t> weights;
+        subtreeWeight(root, weights);
+        placeBlock(0, weights);
+    }
 
-        // Find positions of both words in each file
-        for (int fileId = 0; fileId < fileListCount; fileId++)
+    // Index reached by key, or -1 if the path does not exist. If trace is
+    // given, the address of every node read is appended to it, including
+    // the TrieNode a lookup then reads to check for a term.
+    int32_t walk(const char *key, vector<const void *> *trace = nullptr) const
+    {
+        int32_t index = 0;
+        for (int i = 0; key[i] != '\0'; i++)
         {
-            int positions1[MAX_WORD_LENGTH] = {0};
-            int positions2[MAX_WORD_LENGTH] = {0};
-            int pos1Count = 0, pos2Count = 0;
-
-            // Find positions for word1
-            TrieNode *current = root;
-            for (int i = 0; stemmed1[i] != '\0'; i++)
-            {
-                int index = tolower(stemmed1[i]) - 'a';
-                if (index < 0 || index >= ALPHABET_SIZE || !current->children[index])
-                {
-                    break;
-                }
-                current = current->children[index];
-            }
+            int slot = Alphabet::slot(key[i]);
+            if (slot < 0)
+                return -1;
+
+            const PackedNode &node = nodes[index];
+            if (trace)
+                trace->push_back(&node);
+            int word = slot / 32;
+            uint32_t bit = 1u << (slot % 32);
+            if (!(node.childMask[word] & bit))
+                return -1;
+            int rank = __builtin_popcount(node.childMask[word] & (bit - 1));
+            for (int w = 0; w < word; w++)
+                rank += __builtin_popcount(node.childMask[w]);
+            index = node.firstChild + rank;
+        }
+        if (trace)
+        {
+            trace->push_back(&nodes[index]);
+            trace->push_back(&nodes[index].node->isEndOfWord);
+        }
+        return index;
+    }
 
-            if (current && current->isEndOfWord)
-            {
-                for (int i = 0; i < current->fileInfoCount; i++)
-                {
-                    if (current->fileInfo[i].fileId == fileId)
-                    {
-                        // Copy positions
-                        for (int j = 0; j < MAX_WORD_LENGTH && current->fileInfo[i].positions[j] != 0; j++)
-                        {
-                            positions1[pos1Count++] = current->fileInfo[i].positions[j];
-                        }
-                        break;
-                    }
-                }
-            }
+    TrieNode *nodeAt(int32_t index) const
+    {
+        return nodes[index].node;
+    }
 
-            // Find positions for word2
-            current = root;
-            for (int i = 0; stemmed2[i] != '\0'; i++)
-            {
-                int index = tolower(stemmed2[i]) - 'a';
-                if (index < 0 || index >= ALPHABET_SIZE || !current->children[index])
-                {
-                    break;
-                }
-                current = current->children[index];
-            }
+    // Terminal TrieNode for key, or nullptr; what a lookup through this layout returns
+    TrieNode *findTerm(const char *key) const
+    {
+        int32_t index = walk(key);
+        TrieNode *node = index < 0 ? nullptr : nodes[index].node;
+        return node && node->isEndOfWord ? node : nullptr;
+    }
 
-            if (current && current->isEndOfWord)
-            {
-                for (int i = 0; i < current->fileInfoCount; i++)
-                {
-                    if (current->fileInfo[i].fileId == fileId)
-                    {
-                        // Copy positions
-                        for (int j = 0; j < MAX_WORD_LENGTH && current->fileInfo[i].positions[j] != 0; j++)
-                        {
-                            positions2[pos2Count++] = current->fileInfo[i].positions[j];
-                        }
-                        break;
-                    }
-                }
-            }
+    size_t nodeCount() const
+    {
+        return nodes.size();
+    }
 
-            // Check if words appear close to each other
-            bool foundProximity = false;
-            for (int i = 0; i < pos1Count; i++)
-            {
-                for (int j = 0; j < pos2Count; j++)
-                {
-                    int distance = abs(positions1[i] - positions2[j]);
-                    if (distance <= maxDistance)
-                    {
-                        sprintf(results[resultCount++], "%s (distance: %d)", fileList[fileId], distance);
-                        foundProximity = true;
-                        break;
-                    }
-                }
-                if (foundProximity)
-                    break;
-            }
-        }
+    size_t arrayBytes() const
+    {
+        return nodes.size() * sizeof(PackedNode);
+    }
 
-        return resultCount > 0;
+    int blockDepth() const
+    {
+        return layoutBlockDepth;
     }
+};
 
-    // Export search results to file
-    bool exportResults(const char *filename, const char results[MAX_RESULTS][MAX_WORD_LENGTH], int resultCount)
+// Minimal acyclic finite-state transducer mapping terms to a numeric output
+// (here an offset into the postings table). Unlike a trie it shares suffixes
+// as well as prefixes, so endings like "tion" or "ness" are stored once.
+// Built incrementally from sorted terms (Mihov & Maurel); outputs are pushed
+// toward the start state and summed along the path during lookup.
+class FstDictionary
+{
+private:
+    struct Arc
     {
-        // Ensure the file has .txt extension
-        string txtFilename = filename;
-        if (txtFilename.length() < 4 || txtFilename.substr(txtFilename.length() - 4) != ".txt")
-        {
-            txtFilename += ".txt";
-        }
+        char label;
+        uint32_t target;
+        uint64_t output;
+    };
 
-        FILE *file = fopen(txtFilename.c_str(), "w");
-        if (!file)
+    struct State
+    {
+        uint32_t firstArc;
+        uint32_t arcCount;
+        bool final;
+        uint64_t finalOutput;
+    };
+
+    // Compiled (frozen) automaton
+    vector<State> states;
+    vector<Arc> arcs;
+    uint32_t startState = 0;
+    size_t termCount = 0;
+
+    // Build-time state: the unfrozen path for the previous term and the
+    // register of frozen states used for minimization
+    struct BuildState
+    {
+        bool final = false;
+        uint64_t finalOutput = 0;
+        vector<Arc> arcs;
+    };
+    vector<BuildState> pending;
+    unordered_map<string, uint32_t> registry;
+    string previousTerm;
+
+    // Return an equivalent frozen state, adding it if no equivalent exists
+    uint32_t freeze(const BuildState &state)
+    {
+        string signature;
+        signature.reserve(1 + 8 + state.arcs.size() * 13);
+        signature.push_back(state.final ? 1 : 0);
+        signature.append(reinterpret_cast<const char *>(&state.finalOutput), sizeof(uint64_t));
+        for (const Arc &arc : state.arcs)
         {
-            return false;
+            signature.push_back(arc.label);
+            signature.append(reinterpret_cast<const char *>(&arc.target), sizeof(uint32_t));
+            signature.append(reinterpret_cast<const char *>(&arc.output), sizeof(uint64_t));
         }
 
-        // Get the current date and time
-        time_t now = time(0);
-        struct tm *timeinfo = localtime(&now);
-        char timeStr[80];
-        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", timeinfo);
+        auto found = registry.find(signature);
+        if (found != registry.end())
+            return found->second;
 
-        fprintf(file, "Search Results - %s\n", timeStr);
-        fprintf(file, "--------------------------------\n");
+        uint32_t id = states.size();
+        states.push_back({static_cast<uint32_t>(arcs.size()), static_cast<uint32_t>(state.arcs.size()),
+                          state.final, state.finalOutput});
+        arcs.insert(arcs.end(), state.arcs.begin(), state.arcs.end());
+        registry.emplace(std::move(signature), id);
+        return id;
+    }
 
-        for (int i = 0; i < resultCount; i++)
+    // Freeze pending states deeper than depth, from the bottom up
+    void freezeTail(size_t depth)
+    {
+        for (size_t i = previousTerm.size(); i > depth; i--)
         {
-            fprintf(file, "%d. %s\n", i + 1, results[i]);
+            uint32_t id = freeze(pending[i]);
+            pending[i - 1].arcs.back().target = id;
         }
+    }
 
-        fprintf(file, "--------------------------------\n");
-        fprintf(file, "Total Results: %d\n", resultCount);
-
-        fclose(file);
-        return true;
+    const Arc *findArc(uint32_t state, char label) const
+    {
+        const State &s = states[state];
+        const Arc *begin = arcs.data() + s.firstArc;
+        const Arc *end = begin + s.arcCount;
+        const Arc *arc = lower_bound(begin, end, label, [](const Arc &a, char c)
+                                     { return static_cast<unsigned char>(a.label) < static_cast<unsigned char>(c); });
+        return arc != end && arc->label == label ? arc : nullptr;
     }
 
-    // Export search results to CSV
-    bool exportToCSV(const char *filename, const char results[MAX_RESULTS][MAX_WORD_LENGTH], int resultCount)
+    void enumerate(uint32_t state, string &term, uint64_t output, size_t limit,
+                   vector<pair<string, uint64_t>> &results) const
     {
-        // Ensure the file has .csv extension
-        string csvFilename = filename;
-        if (csvFilename.length() < 4 || csvFilename.substr(csvFilename.length() - 4) != ".csv")
+        if (results.size() >= limit)
+            return;
+        const State &s = states[state];
+        if (s.final)
+            results.push_back({term, output + s.finalOutput});
+
+        for (uint32_t a = 0; a < s.arcCount; a++)
         {
-            csvFilename += ".csv";
+            const Arc &arc = arcs[s.firstArc + a];
+            term.push_back(arc.label);
+            enumerate(arc.target, term, output + arc.output, limit, results);
+            term.pop_back();
         }
+    }
 
-        FILE *file = fopen(csvFilename.c_str(), "w");
-        if (!file)
+    // Depth-first walk carrying one Levenshtein DP row per depth
+    void fuzzyWalk(uint32_t state, const string &query, int maxDistance, const vector<int> &row,
+                   string &term, uint64_t output, vector<pair<string, uint64_t>> &results) const
+    {
+        const State &s = states[state];
+        if (s.final && row.back() <= maxDistance)
+            results.push_back({term, output + s.finalOutput});
+
+        vector<int> next(row.size());
+        for (uint32_t a = 0; a < s.arcCount; a++)
         {
-            return false;
+            const Arc &arc = arcs[s.firstArc + a];
+            next[0] = row[0] + 1;
+            int best = next[0];
+            for (size_t j = 1; j < row.size(); j++)
+            {
+                int cost = query[j - 1] == arc.label ? 0 : 1;
+                next[j] = min({row[j] + 1, next[j - 1] + 1, row[j - 1] + cost});
+                best = min(best, next[j]);
+            }
+            if (best > maxDistance)
+                continue; // No completion of this branch can get back within range
+
+            term.push_back(arc.label);
+            fuzzyWalk(arc.target, query, maxDistance, next, term, output + arc.output, results);
+            term.pop_back();
         }
+    }
 
-        // Get the current date and time
-        time_t now = time(0);
-        struct tm *timeinfo = localtime(&now);
-        char timeStr[80];
-        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", timeinfo);
+public:
+    bool built() const
+    {
+        return !states.empty();
+    }
 
-        // Write CSV header
-        fprintf(file, "Index,Result,Timestamp\n");
+    void clear()
+    {
+        states.clear();
+        arcs.clear();
+        pending.clear();
+        registry.clear();
+        previousTerm.clear();
+        termCount = 0;
+    }
 
-        // Write data rows
-        for (int i = 0; i < resultCount; i++)
+    // Terms must be unique and passed in ascending byte order
+    void build(const vector<string> &terms, const vector<uint64_t> &outputs)
+    {
+        clear();
+        pending.resize(1);
+
+        for (size_t t = 0; t < terms.size(); t++)
         {
-            // Escape any commas in the result
-            char escapedResult[MAX_WORD_LENGTH * 2];
-            int j = 0, k = 0;
-            while (results[i][j] != '\0')
+            const string &term = terms[t];
+            uint64_t output = outputs[t];
+
+            size_t prefix = 0;
+            while (prefix < term.size() && prefix < previousTerm.size() && term[prefix] == previousTerm[prefix])
+                prefix++;
+
+            freezeTail(prefix);
+
+            // Push outputs on the shared prefix toward the start state
+            for (size_t j = 1; j <= prefix; j++)
             {
-                if (results[i][j] == ',')
+                Arc &arc = pending[j - 1].arcs.back();
+                uint64_t common = min(arc.output, output);
+                uint64_t suffix = arc.output - common;
+                arc.output = common;
+                if (suffix > 0)
                 {
-                    escapedResult[k++] = '"';
-                    escapedResult[k++] = results[i][j];
-                    escapedResult[k++] = '"';
+                    for (Arc &next : pending[j].arcs)
+                        next.output += suffix;
+                    if (pending[j].final)
+                        pending[j].finalOutput += suffix;
                 }
-                else
-                {
-                    escapedResult[k++] = results[i][j];
-                }
-                j++;
+                output -= common;
             }
-            escapedResult[k] = '\0';
 
-            fprintf(file, "%d,%s,%s\n", i + 1, escapedResult, timeStr);
+            // Append the unshared suffix as a fresh path
+            if (pending.size() < term.size() + 1)
+                pending.resize(term.size() + 1);
+            for (size_t i = prefix + 1; i <= term.size(); i++)
+            {
+                pending[i] = BuildState();
+                pending[i - 1].arcs.push_back({term[i - 1], 0, 0});
+            }
+            pending[term.size()].final = true;
+            if (prefix < term.size())
+                pending[prefix].arcs.back().output = output;
+            else
+                pending[term.size()].finalOutput = output;
+
+            previousTerm = term;
         }
 
-        fclose(file);
-        return true;
+        freezeTail(0);
+        startState = freeze(pending[0]);
+        termCount = terms.size();
+
+        pending.clear();
+        pending.shrink_to_fit();
+        registry.clear();
+        registry.rehash(0);
+        previousTerm.clear();
+        states.shrink_to_fit();
+        arcs.shrink_to_fit();
     }
 
-    // Export word details to PDF-like text file (simplified PDF representation)
-    bool exportToPDF(const char *filename, const char results[MAX_RESULTS][MAX_WORD_LENGTH], int resultCount)
+    bool lookup(const char *term, uint64_t &output) const
     {
-        // Ensure the file has .pdf extension
-        string pdfFilename = filename;
-        if (pdfFilename.length() < 4 || pdfFilename.substr(pdfFilename.length() - 4) != ".pdf")
+        if (states.empty())
+            return false;
+
+        uint32_t state = startState;
+        uint64_t sum = 0;
+        for (int i = 0; term[i] != '\0'; i++)
         {
-            pdfFilename += ".pdf";
+            const Arc *arc = findArc(state, term[i]);
+            if (!arc)
+                return false;
+            sum += arc->output;
+            state = arc->target;
         }
+        if (!states[state].final)
+            return false;
+        output = sum + states[state].finalOutput;
+        return true;
+    }
 
-        FILE *file = fopen(pdfFilename.c_str(), "wb"); // Use binary mode for better compatibility
-        if (!file)
+    // Up to limit (term, output) pairs starting with prefix, in sorted order
+    void prefixLookup(const char *prefix, size_t limit, vector<pair<string, uint64_t>> &results) const
+    {
+        results.clear();
+        if (states.empty())
+            return;
+
+        uint32_t state = startState;
+        uint64_t sum = 0;
+        for (int i = 0; prefix[i] != '\0'; i++)
         {
-            return false;
+            const Arc *arc = findArc(state, prefix[i]);
+            if (!arc)
+                return;
+            sum += arc->output;
+            state = arc->target;
         }
+        string term = prefix;
+        enumerate(state, term, sum, limit, results);
+    }
 
-        // Get the current date and time
-        time_t now = time(0);
-        struct tm *timeinfo = localtime(&now);
-        char timeStr[80];
-        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", timeinfo);
+    // All terms within maxDistance edits of query
+    void fuzzyLookup(const char *query, int maxDistance, vector<pair<string, uint64_t>> &results) const
+    {
+        results.clear();
+        if (states.empty())
+            return;
 
-        // Basic PDF structure (simplified)
-        fprintf(file, "%%PDF-1.4\n");
+        string q = query;
+        vector<int> row(q.size() + 1);
+        for (size_t j = 0; j < row.size(); j++)
+            row[j] = j;
+        string term;
+        fuzzyWalk(startState, q, maxDistance, row, term, 0, results);
+    }
 
-        // Object 1: Catalog
-        long obj1Pos = ftell(file);
-        fprintf(file, "1 0 obj\n");
-        fprintf(file, "<<\n");
-        fprintf(file, "/Type /Catalog\n");
-        fprintf(file, "/Pages 2 0 R\n");
-        fprintf(file, ">>\n");
-        fprintf(file, "endobj\n");
+    size_t stateCount() const
+    {
+        return states.size();
+    }
 
-        // Object 2: Pages
-        long obj2Pos = ftell(file);
-        fprintf(file, "2 0 obj\n");
-        fprintf(file, "<<\n");
-        fprintf(file, "/Type /Pages\n");
-        fprintf(file, "/Kids [3 0 R]\n");
-        fprintf(file, "/Count 1\n");
-        fprintf(file, ">>\n");
-        fprintf(file, "endobj\n");
+    size_t arcCount() const
+    {
+        return arcs.size();
+    }
 
-        // Object 3: Page
-        long obj3Pos = ftell(file);
-        fprintf(file, "3 0 obj\n");
-        fprintf(file, "<<\n");
-        fprintf(file, "/Type /Page\n");
-        fprintf(file, "/Parent 2 0 R\n");
-        fprintf(file, "/Resources <<\n");
-        fprintf(file, "  /Font <<\n");
-        fprintf(file, "    /F1 4 0 R\n");
-        fprintf(file, "  >>\n");
-        fprintf(file, ">>\n");
-        fprintf(file, "/MediaBox [0 0 612 792]\n");
-        fprintf(file, "/Contents 5 0 R\n");
-        fprintf(file, ">>\n");
-        fprintf(file, "endobj\n");
+    size_t size() const
+    {
+        return termCount;
+    }
 
-        // Object 4: Font
-        long obj4Pos = ftell(file);
-        fprintf(file, "4 0 obj\n");
-        fprintf(file, "<<\n");
-        fprintf(file, "/Type /Font\n");
-        fprintf(file, "/Subtype /Type1\n");
-        fprintf(file, "/BaseFont /Helvetica\n");
-        fprintf(file, "/Encoding /WinAnsiEncoding\n");
-        fprintf(file, ">>\n");
-        fprintf(file, "endobj\n");
+    size_t memoryBytes() const
+    {
+        return states.size() * sizeof(State) + arcs.size() * sizeof(Arc);
+    }
+};
 
-        // Build content string
-        string content = "BT\n";
-        content += "/F1 14 Tf\n";
-        content += "50 750 Td\n";
-        content += "(Mini Search Engine - Export Results) Tj\n";
-        content += "0 -25 Td\n";
-        content += "/F1 10 Tf\n";
-        content += "(Generated on: " + string(timeStr) + ") Tj\n";
-        content += "0 -30 Td\n";
+// Bloom filter over short string keys. Sized from an expected item count
+// and target false-positive rate; k probes use double hashing. A growable
+// filter keeps each key's first hash so it can double its capacity on its
+// own when it fills, without being refilled from the index.
+class BloomFilter
+{
+private:
+    vector<uint64_t> bits;
+    uint64_t bitCount = 0;
+    int hashCount = 0;
+    size_t capacity = 0;
+    size_t itemCount = 0;
+    double targetRate = 0;
+    bool growable = false;
+    vector<uint64_t> keyHashes; // First hash of every key, kept while growable
+
+    // FNV-1a; the second hash is derived from it by a murmur-style finalizer
+    static uint64_t firstHash(const char *key)
+    {
+        uint64_t h = 1469598103934665603ULL;
+        for (int i = 0; key[i] != '\0'; i++)
+        {
+            h ^= static_cast<unsigned char>(key[i]);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
 
-        // Set up a table-like format for results
-        int yPos = 680; // Starting Y position for results
+    static uint64_t secondHash(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h | 1;
+    }
 
-        for (int i = 0; i < resultCount && i < MAX_RESULTS; i++)
+    void setBits(uint64_t h1)
+    {
+        uint64_t h2 = secondHash(h1);
+        for (int i = 0; i < hashCount; i++)
         {
-            // Check if we need to start a new page (simplified - not implementing multi-page)
-            if (yPos < 100)
-            {
-                break;
-            }
+            uint64_t bit = (h1 + i * h2) % bitCount;
+            bits[bit >> 6] |= 1ULL << (bit & 63);
+        }
+    }
 
-            // Sanitize the content for PDF (escape special characters)
-            string line = "";
-            line += "50 " + to_string(yPos) + " Td\n";
-            line += "(";
+    // Re-size for expectedItems and re-add every kept key
+    void resize(size_t expectedItems)
+    {
+        vector<uint64_t> hashes;
+        hashes.swap(keyHashes);
+        configure(expectedItems, targetRate);
+        for (uint64_t h1 : hashes)
+            setBits(h1);
+        itemCount = hashes.size();
+        keyHashes.swap(hashes);
+    }
 
-            // Create a formatted row
-            string rowText = to_string(i + 1) + ". ";
-            for (int j = 0; results[i][j] != '\0'; j++)
-            {
-                char ch = results[i][j];
-                if (ch == '(' || ch == ')' || ch == '\\')
-                {
-                    rowText += "\\";
-                }
-                rowText += ch;
-            }
-            line += rowText;
-            line += ") Tj\n";
+public:
+    bool enabled() const
+    {
+        return bitCount > 0;
+    }
 
-            content += line;
-            yPos -= 20; // Move down for next line
+    void configure(size_t expectedItems, double falsePositiveRate)
+    {
+        expectedItems = max<size_t>(expectedItems, 1);
+        double ln2 = log(2.0);
+        double m = -static_cast<double>(expectedItems) * log(falsePositiveRate) / (ln2 * ln2);
+        bitCount = max<uint64_t>(64, (static_cast<uint64_t>(ceil(m)) + 63) / 64 * 64);
+        hashCount = max(1, static_cast<int>(round(bitCount / static_cast<double>(expectedItems) * ln2)));
+        bits.assign(bitCount / 64, 0);
+        capacity = expectedItems;
+        itemCount = 0;
+        targetRate = falsePositiveRate;
+        keyHashes.clear();
+    }
+
+    // Keep key hashes from now on so the filter can grow by itself
+    void setGrowable()
+    {
+        growable = true;
+    }
+
+    void add(const char *key)
+    {
+        uint64_t h1 = firstHash(key);
+        setBits(h1);
+        itemCount++;
+        if (growable)
+        {
+            keyHashes.push_back(h1);
+            if (itemCount > capacity)
+                resize(capacity * 2);
         }
+    }
 
-        // Add total results count at the bottom
-        content += "50 50 Td\n";
-        content += "(Total Results: " + to_string(resultCount) + ") Tj\n";
-        content += "ET";
+    // Stop growing: shrink to the final key count and drop the kept hashes.
+    // Keys added after this only raise the false-positive rate.
+    void seal()
+    {
+        if (!growable)
+            return;
+        resize(itemCount);
+        growable = false;
+        vector<uint64_t>().swap(keyHashes);
+    }
 
-        // Object 5: Content Stream
-        long obj5Pos = ftell(file);
-        fprintf(file, "5 0 obj\n");
-        fprintf(file, "<<\n");
-        fprintf(file, "/Length %zu\n", content.length());
-        fprintf(file, ">>\n");
-        fprintf(file, "stream\n");
-        fprintf(file, "%s\n", content.c_str());
-        fprintf(file, "endstream\n");
-        fprintf(file, "endobj\n");
+    bool mayContain(const char *key) const
+    {
+        if (!enabled())
+            return true;
+        uint64_t h1 = firstHash(key);
+        uint64_t h2 = secondHash(h1);
+        for (int i = 0; i < hashCount; i++)
+        {
+            uint64_t bit = (h1 + i * h2) % bitCount;
+            if (!(bits[bit >> 6] & (1ULL << (bit & 63))))
+                return false;
+        }
+        return true;
+    }
 
-        // Cross-reference table
-        long xref_pos = ftell(file);
-        fprintf(file, "xref\n");
-        fprintf(file, "0 6\n");
-        fprintf(file, "0000000000 65535 f\n");
-        fprintf(file, "%010ld 00000 n\n", obj1Pos);
-        fprintf(file, "%010ld 00000 n\n", obj2Pos);
-        fprintf(file, "%010ld 00000 n\n", obj3Pos);
-        fprintf(file, "%010ld 00000 n\n", obj4Pos);
-        fprintf(file, "%010ld 00000 n\n", obj5Pos);
+    size_t size() const
+    {
+        return itemCount;
+    }
 
-        // Trailer
-        fprintf(file, "trailer\n");
-        fprintf(file, "<<\n");
-        fprintf(file, "/Size 6\n");
-        fprintf(file, "/Root 1 0 R\n");
-        fprintf(file, ">>\n");
-        fprintf(file, "startxref\n");
-        fprintf(file, "%ld\n", xref_pos);
-        fprintf(file, "%%%%EOF\n");
+    size_t getCapacity() const
+    {
+        return capacity;
+    }
 
-        fclose(file);
-        return true;
+    int getHashCount() const
+    {
+        return hashCount;
+    }
+
+    uint64_t getBitCount() const
+    {
+        return bitCount;
+    }
+
+    size_t memoryBytes() const
+    {
+        return (bits.size() + keyHashes.capacity()) * sizeof(uint64_t);
+    }
+
+    // Expected false-positive rate at the current fill: (1 - e^(-kn/m))^k
+    double estimatedFalsePositiveRate() const
+    {
+        if (!enabled())
+            return 0.0;
+        return pow(1.0 - exp(-hashCount * static_cast<double>(itemCount) / bitCount), hashCount);
     }
 };
 
-// File processing functions
-void processFile(const string &filename, Trie &trie)
+const double DEFAULT_BLOOM_FALSE_POSITIVE_RATE = 0.01;
+const size_t BLOOM_INITIAL_TERMS = 1024;
+const size_t BLOOM_INITIAL_DOCUMENT_TERMS = 256;
+
+// Bit-parallel Levenshtein distance (Myers 1999, in Hyyro's formulation).
+// The pattern's match masks are built once, then each text character updates
+// a whole 64-row column of the DP table with a handful of word operations.
+// Patterns longer than 64 characters are split into 64-bit blocks that pass
+// the horizontal delta of their bottom row to the next block.
+class MyersMatcher
 {
-    FILE *file = fopen(filename.c_str(), "r");
-    if (!file)
+private:
+    int patternLength;
+    int blockCount;
+    vector<uint64_t> peq; // peq[c * blockCount + b]: bit i set where pattern[64 * b + i] == c
+
+    static inline int advanceBlock(uint64_t &pv, uint64_t &mv, uint64_t eq, int hin, uint64_t high)
     {
-        cerr << "Error opening file: " << filename << endl;
-        return;
+        uint64_t xv = eq | mv;
+        if (hin < 0)
+            eq |= 1;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        int hout = (ph & high) ? 1 : ((mh & high) ? -1 : 0);
+
+        ph <<= 1;
+        mh <<= 1;
+        if (hin < 0)
+            mh |= 1;
+        else if (hin > 0)
+            ph |= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+        return hout;
     }
 
-    // Add file to file list and get file ID
-    int fileId = trie.addFile(filename.c_str());
+public:
+    explicit MyersMatcher(const char *pattern)
+    {
+        patternLength = strlen(pattern);
+        blockCount = max(1, (patternLength + 63) / 64);
+        peq.assign(256 * blockCount, 0);
+        for (int i = 0; i < patternLength; i++)
+        {
+            unsigned char c = pattern[i];
+            peq[c * blockCount + i / 64] |= 1ULL << (i % 64);
+        }
+    }
 
-    char word[MAX_WORD_LENGTH];
-    int position = 1;
-    while (fscanf(file, "%99s", word) == 1)
+    int distance(const char *text) const
     {
-        // Improved word cleanup
-        char cleanedWord[MAX_WORD_LENGTH] = {0};
-        int j = 0;
-        for (int i = 0; word[i]; i++)
+        if (patternLength == 0)
+            return strlen(text);
+
+        if (blockCount == 1)
         {
-            if (isalpha(word[i]))
+            uint64_t pv = ~0ULL, mv = 0;
+            uint64_t high = 1ULL << (patternLength - 1);
+            int score = patternLength;
+            for (int j = 0; text[j] != '\0'; j++)
             {
-                cleanedWord[j++] = tolower(word[i]);
+                uint64_t eq = peq[static_cast<unsigned char>(text[j])];
+                uint64_t xv = eq | mv;
+                uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+                uint64_t ph = mv | ~(xh | pv);
+                uint64_t mh = pv & xh;
+                if (ph & high)
+                    score++;
+                else if (mh & high)
+                    score--;
+                ph = (ph << 1) | 1; // Row 0 grows by one per text character
+                mh <<= 1;
+                pv = mh | ~(xv | ph);
+                mv = ph & xv;
             }
+            return score;
         }
 
-        // Stop word removal
-        if (trie.isStopWord(cleanedWord))
+        vector<uint64_t> pv(blockCount, ~0ULL), mv(blockCount, 0);
+        uint64_t lastHigh = 1ULL << ((patternLength - 1) % 64);
+        int score = patternLength;
+        for (int j = 0; text[j] != '\0'; j++)
         {
-            continue;
+            const uint64_t *eq = &peq[static_cast<unsigned char>(text[j]) * blockCount];
+            int carry = 1;
+            for (int b = 0; b < blockCount; b++)
+            {
+                uint64_t high = b == blockCount - 1 ? lastHigh : 1ULL << 63;
+                carry = advanceBlock(pv[b], mv[b], eq[b], carry, high);
+            }
+            score += carry;
+        }
+        return score;
+    }
+
+    // Score many candidates against the same pattern
+    void distances(const vector<string> &texts, vector<int> &out) const
+    {
+        out.resize(texts.size());
+        for (size_t i = 0; i < texts.size(); i++)
+        {
+            out[i] = distance(texts[i].c_str());
         }
+    }
+};
 
-        // Stemming
-        trie.stem(cleanedWord);
+// SymSpell-style deletion index: every term is stored under each string
+// reachable by deleting up to maxDistance characters from its first
+// prefixLength characters. A query generates its own deletes the same way,
+// so candidates come from a few hash lookups and only those are verified.
+// A shorter prefix means fewer keys per term but more candidates to verify.
+class DeletionIndex
+{
+private:
+    int maxDistance = 0;
+    int prefixLength = 0;
+    vector<string> terms;
+    unordered_map<string, vector<uint32_t>> deletes;
+    size_t entryCount = 0;
+
+    // All strings reachable from the word's prefix by up to maxDistance deletes
+    void deletesFor(const char *word, unordered_set<string> &out) const
+    {
+        string key(word, min(strlen(word), static_cast<size_t>(prefixLength)));
+        out.insert(key);
 
-        if (strlen(cleanedWord) > 0)
+        vector<string> frontier(1, key);
+        for (int d = 0; d < maxDistance && !frontier.empty(); d++)
         {
-            trie.insert(cleanedWord, fileId);
+            vector<string> next;
+            for (const string &current : frontier)
+            {
+                for (size_t i = 0; i < current.size(); i++)
+                {
+                    string shorter = current.substr(0, i) + current.substr(i + 1);
+                    if (out.insert(shorter).second)
+                        next.push_back(std::move(shorter));
+                }
+            }
+            frontier.swap(next);
         }
+    }
 
-        position++;
+public:
+    bool enabled() const
+    {
+        return prefixLength > 0;
     }
 
-    fclose(file);
-}
+    int getMaxDistance() const
+    {
+        return maxDistance;
+    }
 
-// New utility functions using added libraries
-namespace Utils
-{
-    // Get current timestamp using chrono
-    string getTimestamp()
+    int getPrefixLength() const
     {
-        auto now = chrono::system_clock::now();
-        auto time = chrono::system_clock::to_time_t(now);
-        stringstream ss;
-        ss << put_time(localtime(&time), "%Y-%m-%d %H:%M:%S");
-        return ss.str();
+        return prefixLength;
     }
 
-    // Get all files in a directory using filesystem
-    vector<string> getFilesInDirectory(const string &directory)
+    void configure(int distance, int prefix)
     {
-        vector<string> files;
-        try
+        maxDistance = distance;
+        prefixLength = prefix;
+        terms.clear();
+        deletes.clear();
+        entryCount = 0;
+    }
+
+    void add(const char *term)
+    {
+        uint32_t id = terms.size();
+        terms.push_back(term);
+
+        unordered_set<string> variants;
+        deletesFor(term, variants);
+        for (const string &variant : variants)
         {
-            for (const auto &entry : fs::directory_iterator(directory))
+            deletes[variant].push_back(id);
+            entryCount++;
+        }
+    }
+
+    // Terms within distance edits of query, closest first then alphabetical
+    void lookup(const char *query, int distance, vector<pair<int, string>> &matches) const
+    {
+        matches.clear();
+        unordered_set<string> variants;
+        deletesFor(query, variants);
+
+        MyersMatcher matcher(query);
+        int queryLength = strlen(query);
+        unordered_set<uint32_t> seen;
+        for (const string &variant : variants)
+        {
+            auto found = deletes.find(variant);
+            if (found == deletes.end())
+                continue;
+            for (uint32_t id : found->second)
             {
-                if (entry.is_regular_file())
-                {
-                    files.push_back(entry.path().string());
-                }
+                if (!seen.insert(id).second)
+                    continue;
+                const string &term = terms[id];
+                if (abs(static_cast<int>(term.size()) - queryLength) > distance)
+                    continue;
+                int d = matcher.distance(term.c_str());
+                if (d <= distance)
+                    matches.push_back({d, term});
             }
         }
-        catch (const fs::filesystem_error &e)
+        sort(matches.begin(), matches.end());
+    }
+
+    size_t termCount() const
+    {
+        return terms.size();
+    }
+
+    size_t keyCount() const
+    {
+        return deletes.size();
+    }
+
+    size_t postingCount() const
+    {
+        return entryCount;
+    }
+
+    // Approximate heap footprint of the keys, id lists and hash buckets
+    size_t memoryBytes() const
+    {
+        size_t bytes = deletes.bucket_count() * sizeof(void *);
+        for (const auto &entry : deletes)
         {
-            cerr << "Filesystem error: " << e.what() << endl;
+            bytes += sizeof(entry) + 2 * sizeof(void *) + entry.first.capacity() + entry.second.capacity() * sizeof(uint32_t);
         }
-        return files;
+        for (const auto &term : terms)
+        {
+            bytes += sizeof(term) + term.capacity();
+        }
+        return bytes;
     }
+};
 
-    // Regular expression word validation
-    bool isValidWord(const string &word)
+const int DELETION_INDEX_PREFIX_LENGTH = 7;
+
+const int DEFAULT_QUERY_TIMEOUT_MS = 100;          // Interactive queries stop after this long
+const long long DEFAULT_QUERY_VISIT_BUDGET = 2000000; // ... or after visiting this many nodes/postings
+const long long SUBSTRING_FILE_COST = 1000;           // Budget charged per document read by substring search
+
+// Limits for one query: a deadline and a cap on trie nodes and postings
+// visited. Traversals call spend() as they go and stop once it returns
+// false, leaving partial results; truncated() then tells the caller.
+// The clock is read only every few hundred visits.
+class QueryBudget
+{
+private:
+    bool bounded;
+    chrono::steady_clock::time_point deadline;
+    long long maxVisits;
+    long long visits = 0;
+    long long nextClockCheck = 0;
+    bool stopped = false;
+
+    static const long long CLOCK_CHECK_INTERVAL = 256;
+
+public:
+    // No limits
+    QueryBudget() : bounded(false), maxVisits(LLONG_MAX) {}
+
+    QueryBudget(chrono::milliseconds timeout, long long visitLimit)
+        : bounded(true), deadline(chrono::steady_clock::now() + timeout), maxVisits(visitLimit) {}
+
+    // The limits every interactive menu query runs under
+    static QueryBudget interactive()
     {
-        static const regex wordRegex("^[a-zA-Z]+$");
-        return regex_match(word, wordRegex);
+        return QueryBudget(chrono::milliseconds(DEFAULT_QUERY_TIMEOUT_MS), DEFAULT_QUERY_VISIT_BUDGET);
     }
 
-    // Random word selection using random library
-    string getRandomWord(const vector<string> &words)
+    // Shared unlimited budget for callers that pass none; spend() never
+    // writes to an unbounded budget, so sharing it across threads is safe
+    static QueryBudget &unlimited()
     {
-        if (words.empty())
-            return "";
+        static QueryBudget none;
+        return none;
+    }
 
-        random_device rd;
-        mt19937 gen(rd());
-        uniform_int_distribution<> distrib(0, words.size() - 1);
+    // Account for count more visits; false once the budget is used up
+    bool spend(long long count = 1)
+    {
+        if (!bounded)
+            return true;
+        if (stopped)
+            return false;
+        visits += count;
+        if (visits > maxVisits)
+        {
+            stopped = true;
+        }
+        else if (visits >= nextClockCheck)
+        {
+            nextClockCheck = visits + CLOCK_CHECK_INTERVAL;
+            stopped = chrono::steady_clock::now() >= deadline;
+        }
+        return !stopped;
+    }
 
-        return words[distrib(gen)];
+    bool truncated() const
+    {
+        return stopped;
     }
 
-    // Multithreaded file processing
-    void processFilesParallel(const vector<string> &files, Trie &trie)
+    long long visited() const
+    {
+        return visits;
+    }
+};
+
+// Auxiliary term indexes for non-prefix matching. Terms are appended to one
+// NUL-separated buffer as they are first inserted. A trie over reversed
+// terms answers suffix queries, and a suffix array over the buffer answers
+// infix queries. The suffix array is re-sorted lazily after new terms arrive.
+template <class Alphabet>
+class AffixIndex
+{
+private:
+    struct ReverseNode
     {
-        const unsigned int maxThreads = thread::hardware_concurrency();
-        const unsigned int numThreads = min(maxThreads, static_cast<unsigned int>(files.size()));
+        int32_t children[Alphabet::SIZE];
+        int32_t termId; // -1 if no term ends here
+    };
+
+    vector<char> buffer;          // "term\0term\0..."
+    vector<uint32_t> termStarts;  // Offset of each term in buffer
+    vector<ReverseNode> reverse;  // Node 0 is the root
+    vector<uint32_t> suffixArray; // Buffer offsets sorted by the suffix text
+    bool suffixArrayStale = false;
+
+    int32_t newReverseNode()
+    {
+        ReverseNode node;
+        fill(node.children, node.children + Alphabet::SIZE, -1);
+        node.termId = -1;
+        reverse.push_back(node);
+        return reverse.size() - 1;
+    }
+
+    // Every term under node. The reverse trie orders terms by their last
+    // letters, so only a budget cut can stop early, leaving an unsorted sample.
+    void collectReverse(int32_t node, vector<uint32_t> &ids, QueryBudget &budget) const
+    {
+        if (!budget.spend())
+            return;
+        if (reverse[node].termId >= 0)
+            ids.push_back(reverse[node].termId);
+        for (int i = 0; i < Alphabet::SIZE; i++)
+        {
+            if (reverse[node].children[i] >= 0)
+                collectReverse(reverse[node].children[i], ids, budget);
+        }
+    }
+
+    // The first limit distinct terms of ids in sorted order
+    void termsFor(vector<uint32_t> &ids, size_t limit, vector<string> &terms) const
+    {
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        size_t count = min(limit, ids.size());
+        partial_sort(ids.begin(), ids.begin() + count, ids.end(), [this](uint32_t a, uint32_t b)
+                     { return strcmp(term(a), term(b)) < 0; });
+        terms.clear();
+        for (size_t i = 0; i < count; i++)
+            terms.push_back(term(ids[i]));
+    }
+
+public:
+    AffixIndex()
+    {
+        newReverseNode();
+    }
+
+    const char *term(uint32_t id) const
+    {
+        return buffer.data() + termStarts[id];
+    }
+
+    // Register a new term (a normalized key)
+    void add(const char *key)
+    {
+        uint32_t id = termStarts.size();
+        termStarts.push_back(buffer.size());
+        size_t length = strlen(key);
+        buffer.insert(buffer.end(), key, key + length + 1);
+
+        int32_t node = 0;
+        for (size_t i = length; i-- > 0;)
+        {
+            int index = Alphabet::slot(key[i]);
+            if (reverse[node].children[index] < 0)
+            {
+                int32_t child = newReverseNode();
+                reverse[node].children[index] = child;
+            }
+            node = reverse[node].children[index];
+        }
+        reverse[node].termId = id;
+        suffixArrayStale = true;
+    }
+
+    bool needsRebuild() const
+    {
+        return suffixArrayStale;
+    }
+
+    void rebuildSuffixArray()
+    {
+        suffixArray.clear();
+        for (size_t i = 0; i < buffer.size(); i++)
+        {
+            if (buffer[i] != '\0')
+                suffixArray.push_back(i);
+        }
+        const char *text = buffer.data();
+        sort(suffixArray.begin(), suffixArray.end(), [text](uint32_t a, uint32_t b)
+             { return strcmp(text + a, text + b) < 0; });
+        suffixArrayStale = false;
+    }
+
+    // Terms ending with suffix, in sorted order
+    void suffixMatches(const char *suffix, size_t limit, vector<string> &terms,
+                       QueryBudget &budget = QueryBudget::unlimited()) const
+    {
+        terms.clear();
+        int32_t node = 0;
+        for (size_t i = strlen(suffix); i-- > 0;)
+        {
+            int index = Alphabet::slot(suffix[i]);
+            node = index < 0 ? -1 : reverse[node].children[index];
+            if (node < 0)
+                return;
+        }
+        vector<uint32_t> ids;
+        collectReverse(node, ids, budget);
+        termsFor(ids, limit, terms);
+    }
+
+    // Terms containing infix anywhere, in sorted order. Needs a current suffix array.
+    void infixMatches(const char *infix, size_t limit, vector<string> &terms,
+                      QueryBudget &budget = QueryBudget::unlimited()) const
+    {
+        terms.clear();
+        size_t length = strlen(infix);
+        const char *text = buffer.data();
+
+        // Suffixes starting with infix form one contiguous range
+        auto first = lower_bound(suffixArray.begin(), suffixArray.end(), infix, [&](uint32_t offset, const char *key)
+                                 { return strncmp(text + offset, key, length) < 0; });
+        auto last = upper_bound(first, suffixArray.end(), infix, [&](const char *key, uint32_t offset)
+                                { return strncmp(key, text + offset, length) < 0; });
+
+        vector<uint32_t> ids;
+        for (auto it = first; it != last && budget.spend(); ++it)
+        {
+            // Owning term is the last one starting at or before the offset
+            ids.push_back(upper_bound(termStarts.begin(), termStarts.end(), *it) - termStarts.begin() - 1);
+        }
+        termsFor(ids, limit, terms);
+    }
+
+    size_t memoryBytes() const
+    {
+        return buffer.capacity() + termStarts.capacity() * sizeof(uint32_t) +
+               reverse.capacity() * sizeof(ReverseNode) + suffixArray.capacity() * sizeof(uint32_t);
+    }
+};
+
+// Byte trigrams seen in one document's raw tokens (lowercased, digits and
+// punctuation kept). Tokens longer than fscanf's 99-byte limit arrive in
+// pieces, so the last two bytes of a full-length piece carry over.
+struct TrigramCollector
+{
+    unordered_set<uint32_t> grams;
+    char tail[2];
+    int tailLength = 0;
+
+    static uint32_t pack(unsigned char a, unsigned char b, unsigned char c)
+    {
+        return (static_cast<uint32_t>(a) << 16) | (static_cast<uint32_t>(b) << 8) | c;
+    }
+
+    void addToken(const char *raw)
+    {
+        char text[MAX_WORD_LENGTH + 2];
+        int length = 0;
+        for (int i = 0; i < tailLength; i++)
+            text[length++] = tail[i];
+        int rawLength = 0;
+        for (; raw[rawLength] != '\0'; rawLength++)
+            text[length++] = tolower(static_cast<unsigned char>(raw[rawLength]));
+
+        for (int i = 0; i + 2 < length; i++)
+            grams.insert(pack(text[i], text[i + 1], text[i + 2]));
+
+        tailLength = 0;
+        if (rawLength == MAX_WORD_LENGTH - 1)
+        {
+            tail[0] = text[length - 2];
+            tail[1] = text[length - 1];
+            tailLength = 2;
+        }
+    }
+
+    void merge(const TrigramCollector &other)
+    {
+        grams.insert(other.grams.begin(), other.grams.end());
+    }
+};
+
+// Trigram -> sorted ids of documents containing it. Substring candidates are
+// the intersection of the query's trigram postings; callers verify them.
+class TrigramIndex
+{
+private:
+    bool active = false;
+    unordered_map<uint32_t, vector<DocId>> postings;
+
+public:
+    bool enabled() const
+    {
+        return active;
+    }
+
+    void enable()
+    {
+        active = true;
+    }
+
+    void addDocument(DocId fileId, const TrigramCollector &collector)
+    {
+        for (uint32_t gram : collector.grams)
+        {
+            vector<DocId> &docs = postings[gram];
+            docs.insert(lower_bound(docs.begin(), docs.end(), fileId), fileId);
+        }
+    }
+
+    const unordered_map<uint32_t, vector<DocId>> &allPostings() const
+    {
+        return postings;
+    }
+
+    // Restore one trigram's sorted document list, e.g. from a snapshot
+    void setPostings(uint32_t gram, vector<DocId> docs)
+    {
+        postings[gram] = move(docs);
+    }
+
+    // Candidate documents for text, or false if text has no trigram to filter on
+    bool candidates(const char *text, vector<DocId> &docs) const
+    {
+        docs.clear();
+        vector<const vector<DocId> *> lists;
+        TrigramCollector query;
+        // Whitespace in the query may not match the document's spacing exactly,
+        // so only trigrams inside each whitespace separated piece are used
+        istringstream pieces(text);
+        string piece;
+        while (pieces >> piece)
+            query.addToken(piece.c_str());
+
+        for (uint32_t gram : query.grams)
+        {
+            auto found = postings.find(gram);
+            if (found == postings.end())
+                return true; // Some trigram occurs nowhere: no candidates
+            lists.push_back(&found->second);
+        }
+        if (lists.empty())
+            return false;
+
+        // Intersect shortest first
+        sort(lists.begin(), lists.end(), [](const vector<DocId> *a, const vector<DocId> *b)
+             { return a->size() < b->size(); });
+        docs = *lists[0];
+        for (size_t i = 1; i < lists.size() && !docs.empty(); i++)
+        {
+            vector<DocId> next;
+            set_intersection(docs.begin(), docs.end(), lists[i]->begin(), lists[i]->end(), back_inserter(next));
+            docs.swap(next);
+        }
+        return true;
+    }
+
+    size_t trigramCount() const
+    {
+        return postings.size();
+    }
+};
+
+// Case-insensitive search for text in a file, reading it in blocks that
+// overlap by the needle length so matches across block edges are found
+bool fileContainsText(const char *filename, const string &lowerText)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    size_t keep = lowerText.size() - 1;
+    string window;
+    vector<char> buffer(CHUNK_READ_BUFFER_SIZE);
+    bool found = false;
+    size_t got;
+    while (!found && (got = fread(buffer.data(), 1, buffer.size(), file)) > 0)
+    {
+        for (size_t i = 0; i < got; i++)
+            window.push_back(tolower(static_cast<unsigned char>(buffer[i])));
+        found = window.find(lowerText) != string::npos;
+        if (window.size() > keep)
+            window.erase(0, window.size() - keep);
+    }
+    fclose(file);
+    return found;
+}
+
+const char *const SEGMENT_DIRECTORY = "index_segments";
+const int SEGMENT_MERGE_FANOUT = 4;                       // Segments of one tier merged together
+
+// Combine postings from several sources (oldest first) into one list sorted
+// by fileId. A document split across sources, e.g. by a flush in the middle
+// of indexing it, gets its frequencies summed and its positions appended.
+void combinePostings(vector<FileInfo> &postings)
+{
+    stable_sort(postings.begin(), postings.end(), [](const FileInfo &a, const FileInfo &b)
+                { return a.fileId < b.fileId; });
+    size_t out = 0;
+    for (size_t i = 0; i < postings.size(); i++)
+    {
+        if (out > 0 && postings[out - 1].fileId == postings[i].fileId)
+        {
+            FileInfo &into = postings[out - 1];
+            into.frequency += postings[i].frequency;
+            for (int k = 0; k < postings[i].positionCount && into.positionCount < MAX_WORD_LENGTH; k++)
+                into.positions[into.positionCount++] = postings[i].positions[k];
+        }
+        else
+        {
+            if (out != i)
+                postings[out] = postings[i];
+            out++;
+        }
+    }
+    postings.resize(out);
+}
+
+// Immutable on-disk index segment: the postings flushed from memory at one
+// point, as CompressedPostings records followed by a sorted term dictionary.
+// The dictionary and a Bloom filter over it are loaded into memory; records
+// are read through a memory map. A segment replaced by a merge is marked
+// obsolete and its file is removed once the last reader lets go of it.
+//
+// Layout: "LSMSEG01", uint32 termCount, uint64 dictionaryOffset, records...,
+// then per term: uint64 recordOffset, uint16 length, key bytes.
+class IndexSegment
+{
+private:
+    string filePath;
+    PostingsFile file;
+    vector<string> keys; // Sorted
+    vector<uint64_t> offsets;
+    BloomFilter filter;
+    int mergeTier = 0;
+    atomic<bool> obsolete{false};
+
+public:
+    static const size_t HEADER_BYTES = 8 + sizeof(uint32_t) + sizeof(uint64_t);
+
+    // Streams terms, in sorted order, into a new segment file. A file that
+    // could not be written completely is deleted by finish.
+    class Writer
+    {
+    private:
+        string path;
+        FILE *out;
+        vector<pair<string, uint64_t>> dictionary;
+        vector<uint8_t> record;
+        bool ok;
+
+    public:
+        explicit Writer(const string &path) : path(path)
+        {
+            out = fopen(path.c_str(), "wb");
+            ok = out && fwrite("LSMSEG01", 1, 8, out) == 8 && fseek(out, HEADER_BYTES, SEEK_SET) == 0;
+        }
+
+        void add(const string &key, const vector<FileInfo> &postings)
+        {
+            if (!ok || postings.empty())
+                return;
+            dictionary.push_back({key, static_cast<uint64_t>(ftell(out))});
+            record.clear();
+            CompressedPostings::encode(postings, record);
+            ok = fwrite(record.data(), 1, record.size(), out) == record.size();
+        }
+
+        size_t termCount() const
+        {
+            return dictionary.size();
+        }
+
+        bool finish()
+        {
+            if (!out)
+                return false;
+            uint64_t dictionaryOffset = ftell(out);
+            for (const auto &entry : dictionary)
+            {
+                uint16_t length = entry.first.size();
+                ok = ok && fwrite(&entry.second, sizeof(uint64_t), 1, out) == 1 &&
+                     fwrite(&length, sizeof(length), 1, out) == 1 &&
+                     fwrite(entry.first.data(), 1, length, out) == length;
+            }
+            uint32_t count = dictionary.size();
+            ok = ok && fseek(out, 8, SEEK_SET) == 0 && fwrite(&count, sizeof(count), 1, out) == 1 &&
+                 fwrite(&dictionaryOffset, sizeof(dictionaryOffset), 1, out) == 1;
+            ok = fclose(out) == 0 && ok;
+            out = nullptr;
+            if (!ok)
+                remove(path.c_str());
+            return ok;
+        }
+    };
+
+    ~IndexSegment()
+    {
+        file.close();
+        if (obsolete)
+            remove(filePath.c_str());
+    }
+
+    // tier is 0 for a flushed segment and one more than its inputs' for a
+    // merged one, so each segment is rewritten O(log n) times
+    bool open(const string &path, int tier)
+    {
+        filePath = path;
+        mergeTier = tier;
+        if (!file.open(path.c_str()) || file.bytes() < HEADER_BYTES)
+            return false;
+
+        const uint8_t *data = file.begin();
+        uint32_t count;
+        uint64_t position;
+        if (memcmp(data, "LSMSEG01", 8) != 0)
+            return false;
+        memcpy(&count, data + 8, sizeof(count));
+        memcpy(&position, data + 8 + sizeof(count), sizeof(position));
+
+        filter.configure(max<size_t>(count, 1), DEFAULT_BLOOM_FALSE_POSITIVE_RATE);
+        for (uint32_t i = 0; i < count && position + sizeof(uint64_t) + sizeof(uint16_t) <= file.bytes(); i++)
+        {
+            uint64_t offset;
+            uint16_t length;
+            memcpy(&offset, data + position, sizeof(offset));
+            memcpy(&length, data + position + sizeof(offset), sizeof(length));
+            position += sizeof(offset) + sizeof(length);
+            keys.emplace_back(reinterpret_cast<const char *>(data + position), length);
+            offsets.push_back(offset);
+            filter.add(keys.back().c_str());
+            position += length;
+        }
+        return keys.size() == count;
+    }
+
+    // Record offset for key, or -1 if the segment has no postings for it
+    long long find(const char *key) const
+    {
+        if (!filter.mayContain(key))
+            return -1;
+        auto it = lower_bound(keys.begin(), keys.end(), key, [](const string &a, const char *b)
+                              { return strcmp(a.c_str(), b) < 0; });
+        if (it == keys.end() || *it != key)
+            return -1;
+        return offsets[it - keys.begin()];
+    }
+
+    CompressedPostings::Reader reader(long long offset) const
+    {
+        return file.reader(offset);
+    }
+
+    const vector<string> &terms() const
+    {
+        return keys;
+    }
+
+    uint64_t termOffset(size_t index) const
+    {
+        return offsets[index];
+    }
+
+    const string &path() const
+    {
+        return filePath;
+    }
+
+    size_t bytes() const
+    {
+        return file.bytes();
+    }
+
+    int tier() const
+    {
+        return mergeTier;
+    }
+
+    void markObsolete()
+    {
+        obsolete = true;
+    }
+};
+
+using SegmentList = vector<shared_ptr<IndexSegment>>; // Oldest first
+
+// Merge segments (oldest first) into one new segment at path
+shared_ptr<IndexSegment> mergeSegments(const SegmentList &inputs, const string &path)
+{
+    IndexSegment::Writer writer(path);
+    vector<size_t> next(inputs.size(), 0);
+    vector<FileInfo> postings, part;
+    while (true)
+    {
+        // Smallest key not yet written across all inputs
+        const string *key = nullptr;
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            if (next[i] < inputs[i]->terms().size() && (!key || inputs[i]->terms()[next[i]] < *key))
+                key = &inputs[i]->terms()[next[i]];
+        }
+        if (!key)
+            break;
+
+        string term = *key;
+        postings.clear();
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            if (next[i] < inputs[i]->terms().size() && inputs[i]->terms()[next[i]] == term)
+            {
+                inputs[i]->reader(inputs[i]->termOffset(next[i])).decode(part);
+                postings.insert(postings.end(), part.begin(), part.end());
+                next[i]++;
+            }
+        }
+        combinePostings(postings);
+        writer.add(term, postings);
+    }
+
+    auto merged = make_shared<IndexSegment>();
+    if (!writer.finish() || !merged->open(path, inputs.front()->tier() + 1))
+    {
+        merged->markObsolete();
+        return nullptr;
+    }
+    return merged;
+}
+
+const char *const WAL_FILE = "index.wal";
+const char *const SNAPSHOT_FILE = "index.snapshot";
+const int WAL_CHECKPOINT_RECORDS = 1024; // Background indexing checkpoints once the log holds this many
+
+// CRC-32 (IEEE, reflected), used to detect torn or corrupted log records
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0)
+{
+    static const auto table = []
+    {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Write-ahead log of document additions and removals since the last
+// snapshot. Records are framed as uint32 length, uint32 CRC-32 of type and
+// payload, uint8 type, payload. Appends only buffer; commit makes a record
+// durable, and whichever committer finds no write in progress writes and
+// syncs everything buffered so far, so concurrent indexing threads share
+// one fdatasync (group commit).
+class WriteAheadLog
+{
+private:
+    int fd = -1;
+    mutex logMutex;
+    condition_variable durable;
+    string pending;                    // Encoded records not yet written
+    unsigned long long appended = 0;   // Sequence number of the last appended record
+    unsigned long long written = 0;    // Sequence number of the last durable record
+    bool writing = false;
+    bool failed = false;
+    long long records = 0;             // Records in the file since the last reset
+    long long syncs = 0;
+
+public:
+    enum RecordType : uint8_t
+    {
+        ADD_DOCUMENT = 1,
+        REMOVE_DOCUMENT = 2
+    };
+
+    ~WriteAheadLog()
+    {
+        close();
+    }
+
+    // Call every valid record in path in order. A torn or corrupt tail,
+    // e.g. from a crash mid-write, ends the log and is cut off. Returns the
+    // number of records replayed, or -1 if the log cannot be read.
+    static long long replay(const char *path, const function<void(uint8_t, const string &)> &apply)
+    {
+        ifstream in(path, ios::binary);
+        if (!in)
+            return fs::exists(path) ? -1 : 0;
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        in.close();
+
+        const size_t headerBytes = 2 * sizeof(uint32_t) + 1;
+        size_t position = 0;
+        long long count = 0;
+        while (position + headerBytes <= data.size())
+        {
+            uint32_t length, crc;
+            memcpy(&length, &data[position], sizeof(length));
+            memcpy(&crc, &data[position + sizeof(length)], sizeof(crc));
+            if (length > data.size() - position - headerBytes)
+                break;
+            const uint8_t *body = reinterpret_cast<const uint8_t *>(&data[position + 2 * sizeof(uint32_t)]);
+            if (crc32(body, length + 1) != crc)
+                break;
+            apply(body[0], string(reinterpret_cast<const char *>(body + 1), length));
+            position += headerBytes + length;
+            count++;
+        }
+        if (position < data.size())
+        {
+            cerr << "Write-ahead log: dropped " << data.size() - position << " bytes of torn or corrupt records\n";
+            if (truncate(path, position) != 0)
+                return -1;
+        }
+        return count;
+    }
+
+    bool open(const char *path, long long existingRecords)
+    {
+        close();
+        fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        records = existingRecords;
+        failed = false;
+        return fd >= 0;
+    }
+
+    void close()
+    {
+        if (fd >= 0)
+            commit(appended);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    bool isOpen() const
+    {
+        return fd >= 0;
+    }
+
+    // Buffer a record; returns its sequence number for commit
+    unsigned long long append(RecordType type, const string &payload)
+    {
+        lock_guard<mutex> lock(logMutex);
+        string body(1, static_cast<char>(type));
+        body += payload;
+        uint32_t length = payload.size();
+        uint32_t crc = crc32(reinterpret_cast<const uint8_t *>(body.data()), body.size());
+        pending.append(reinterpret_cast<const char *>(&length), sizeof(length));
+        pending.append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+        pending += body;
+        records++;
+        return ++appended;
+    }
+
+    // Wait until record sequence is on disk; false if the log could not be written
+    bool commit(unsigned long long sequence)
+    {
+        unique_lock<mutex> lock(logMutex);
+        while (written < sequence && !failed)
+        {
+            if (writing)
+            {
+                durable.wait(lock);
+                continue;
+            }
+
+            // Become the leader for everything buffered so far
+            writing = true;
+            string batch;
+            batch.swap(pending);
+            unsigned long long batchEnd = appended;
+            lock.unlock();
+
+            bool ok = true;
+            for (size_t done = 0; ok && done < batch.size();)
+            {
+                ssize_t n = write(fd, batch.data() + done, batch.size() - done);
+                ok = n > 0;
+                done += ok ? n : 0;
+            }
+            ok = ok && fdatasync(fd) == 0;
+
+            lock.lock();
+            writing = false;
+            written = batchEnd;
+            failed = !ok;
+            syncs++;
+            durable.notify_all();
+        }
+        return !failed;
+    }
+
+    // Empty the log once a snapshot covers everything in it
+    bool reset()
+    {
+        unique_lock<mutex> lock(logMutex);
+        durable.wait(lock, [this]
+                     { return !writing; });
+        pending.clear();
+        written = appended;
+        records = 0;
+        durable.notify_all();
+        return fd >= 0 && ftruncate(fd, 0) == 0 && fdatasync(fd) == 0;
+    }
+
+    long long recordCount()
+    {
+        lock_guard<mutex> lock(logMutex);
+        return records;
+    }
+
+    long long syncCount()
+    {
+        lock_guard<mutex> lock(logMutex);
+        return syncs;
+    }
+};
+
+// Lazy in-order walk over the terms of a trie subtree. An explicit stack
+// replaces recursion, so a cursor can stop after any term and carry on
+// later; seek() starts it just past a given term instead, which lets
+// callers page through a prefix with work proportional to the page.
+// Terms come out in key order as views of the nodes' words, valid for as
+// long as the trie is.
+template <class Alphabet>
+class BasicTrieCursor
+{
+private:
+    using TrieNode = BasicTrieNode<Alphabet>;
+
+    struct Frame
+    {
+        TrieNode *node;
+        int nextChild; // -1 until the node's own word has been considered
+    };
+    vector<Frame> stack;
+
+public:
+    BasicTrieCursor() {}
+
+    explicit BasicTrieCursor(TrieNode *subtree)
+    {
+        reset(subtree);
+    }
+
+    // Start over at the first term of subtree (none if null)
+    void reset(TrieNode *subtree)
+    {
+        stack.clear();
+        if (subtree)
+            stack.push_back({subtree, -1});
+    }
+
+    // Position the cursor after the term reached from subtree by path (a
+    // normalized key): the next term is the first one greater than it,
+    // whether or not path itself is a term
+    void seek(TrieNode *subtree, const char *path)
+    {
+        reset(subtree);
+        for (int i = 0; path[i] != '\0' && !stack.empty(); i++)
+        {
+            // Everything up to and including this branch sorts before path
+            int branch = Alphabet::slot(path[i]);
+            Frame &top = stack.back();
+            top.nextChild = branch + 1;
+            TrieNode *child = top.node->children[branch];
+            if (!child)
+                return;
+            stack.push_back({child, -1});
+        }
+        if (!stack.empty())
+            stack.back().nextChild = 0; // path's own word, children still to come
+    }
+
+    // Next term, or false when the subtree is exhausted or the budget ran
+    // out. A cursor stopped by its budget resumes where it left off.
+    bool next(string_view &term, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        while (!stack.empty())
+        {
+            Frame &top = stack.back();
+            if (top.nextChild < 0)
+            {
+                if (!budget.spend())
+                    return false;
+                top.nextChild = 0;
+                if (top.node->isEndOfWord)
+                {
+                    term = top.node->word;
+                    return true;
+                }
+            }
+            while (top.nextChild < Alphabet::SIZE && !top.node->children[top.nextChild])
+                top.nextChild++;
+            if (top.nextChild == Alphabet::SIZE)
+            {
+                stack.pop_back();
+                continue;
+            }
+            TrieNode *child = top.node->children[top.nextChild++];
+            stack.push_back({child, -1});
+        }
+        return false;
+    }
+
+    bool done() const
+    {
+        return stack.empty();
+    }
+
+    // Node of the term next() last returned
+    TrieNode *node() const
+    {
+        return stack.back().node;
+    }
+};
+
+using TrieCursor = BasicTrieCursor<TRIE_ALPHABET>;
+
+// One query result as data: the document, the term it is for (the
+// indexed word, null for whole-query hits), how often the term occurs there, the span of the
+// positions that matched (-1 when not tracked) and a score (0 for
+// queries that do not rank). Turning hits into text is left to whoever
+// shows them.
+struct SearchHit
+{
+    DocId docId;
+    const char *term;
+    int frequency;
+    int firstPosition;
+    int lastPosition;
+    double score;
+};
+
+// Caller-owned result buffer. clear() keeps the capacity, so a buffer
+// reused across queries stops allocating once it has grown.
+struct SearchResults
+{
+    vector<SearchHit> hits;
+    const char *term = nullptr;     // The term looked up, for single-term queries
+    long long totalOccurrences = 0; // Its occurrences in live documents
+
+    void clear()
+    {
+        hits.clear();
+        term = nullptr;
+        totalOccurrences = 0;
+    }
+
+    void add(DocId docId, const char *hitTerm = nullptr, int frequency = 0, int firstPosition = -1,
+             int lastPosition = -1, double score = 0)
+    {
+        hits.push_back({docId, hitTerm, frequency, firstPosition, lastPosition, score});
+    }
+};
+
+// Growable table of indexed documents. Paths are interned once and found
+// through a hash index, so registering or looking up a document is O(1)
+// however many are indexed. Interned paths never move, so pointers returned
+// by path() stay valid while more documents are added.
+class DocumentTable
+{
+private:
+    deque<string> paths; // Indexed by DocId
+    unordered_map<string_view, DocId> ids;
+    size_t pathBytes = 0;
+
+public:
+    // Id of path, registering it if new
+    DocId add(const char *path)
+    {
+        auto found = ids.find(path);
+        if (found != ids.end())
+            return found->second;
+
+        DocId id = paths.size();
+        paths.emplace_back(path);
+        ids.emplace(paths.back(), id);
+        pathBytes += paths.back().size() + 1;
+        return id;
+    }
+
+    // Register path under a new id even if it is already known, e.g. for
+    // a file whose content changed. The old id keeps its path; find
+    // returns the new one.
+    DocId replace(const char *path)
+    {
+        auto found = ids.find(path);
+        if (found != ids.end())
+            ids.erase(found);
+
+        DocId id = paths.size();
+        paths.emplace_back(path);
+        ids.emplace(paths.back(), id);
+        pathBytes += paths.back().size() + 1;
+        return id;
+    }
+
+    // Id of path, or -1 if it is not registered
+    long long find(const char *path) const
+    {
+        auto found = ids.find(path);
+        return found == ids.end() ? -1 : static_cast<long long>(found->second);
+    }
+
+    const char *path(DocId id) const
+    {
+        return paths[id].c_str();
+    }
+
+    size_t size() const
+    {
+        return paths.size();
+    }
+
+    size_t memoryBytes() const
+    {
+        return pathBytes + paths.size() * (sizeof(string) + sizeof(pair<string_view, DocId>) + sizeof(void *));
+    }
+};
+
+// The search index, specialized at compile time for the characters its
+// keys are made of (see ByteAlphabet); the program uses Trie, the
+// instance for TRIE_ALPHABET.
+template <class Alphabet>
+class BasicTrie
+{
+public:
+    using TrieNode = BasicTrieNode<Alphabet>;
+    using TrieCursor = BasicTrieCursor<Alphabet>;
+    using DoubleArray = DoubleArrayTrie<Alphabet>;
+    using PackedLayout = PackedTrie<Alphabet>;
+
+private:
+    TrieNode *root;
+    DocumentTable documents;
+    // Indexing threads lock it exclusively, queries shared. The frozen-view
+    // getters (getDoubleArray and friends) are for the index tools and unlocked.
+    shared_mutex indexMutex;
+    DoubleArray doubleArray;     // Optional frozen view, dropped when the vocabulary changes
+    PackedLayout packedTrie;     // Optional cache-conscious frozen view, also dropped on change
+    FstDictionary termFst;       // Optional term -> postings table offset, also dropped on change
+    vector<TrieNode *> fstPostings;
+
+    // Negative-lookup filters: one over the whole vocabulary and one per
+    // document. They are grown (rebuilt at double capacity) as terms arrive.
+    double bloomFalsePositiveRate;
+    BloomFilter termFilter;
+    deque<BloomFilter> documentFilters; // One per document; a deque so growth never moves existing filters
+    atomic<long long> termProbes, termRejects, documentProbes, documentRejects;
+
+    DeletionIndex deletionIndex; // Optional spelling index, maintained by insert once enabled
+    AffixIndex<Alphabet> affixIndex; // Suffix and infix term lookup
+    TrigramIndex trigramIndex;   // Optional substring index over raw document text
+    PostingsFile postingsFile;   // Spilled postings, referenced by TrieNode::postingsOffset
+    DocSet deletedDocuments;     // Tombstones: files removed from results without reindexing
+    unordered_set<DocId> pendingDocuments; // Registered but not yet finished; left out of snapshots
+    WriteAheadLog *writeAheadLog = nullptr; // Optional log of document additions and removals
+
+    // LSM-style segments: once live postings outgrow memoryBudget they are
+    // frozen, then written by a background thread into an immutable on-disk
+    // segment, and the trie keeps only the vocabulary. Readers take a
+    // snapshot of the list; the same thread merges runs of same-tier
+    // segments and publishes the result.
+    size_t memoryBudget = 0; // Bytes of live postings; 0 = never flush
+    size_t livePostingsBytes = 0;
+    vector<TrieNode *> liveTerms; // Terms given resident postings since the last flush
+    shared_ptr<const SegmentList> segments = make_shared<const SegmentList>();
+
+    // Live postings taken out of the trie by a flush, readable here until
+    // the merge thread has written them into a segment
+    struct FrozenPostings
+    {
+        vector<TrieNode *> nodes;                 // In no particular order
+        vector<vector<FileInfo>> postings;        // Parallel to nodes
+        vector<pair<TrieNode *, uint32_t>> index; // (node, position), sorted for find
+
+        const vector<FileInfo> *find(TrieNode *node) const
+        {
+            auto it = lower_bound(index.begin(), index.end(), make_pair(node, 0u));
+            return it != index.end() && it->first == node ? &postings[it->second] : nullptr;
+        }
+    };
+    vector<shared_ptr<const FrozenPostings>> frozenPostings; // Oldest first, newer than every segment
+    DocSet flushedDocuments; // Documents with postings in some segment or frozen batch
+    atomic<int> nextSegmentNumber{0};
+    atomic<int> flushCount{0}, mergeCount{0};
+    thread mergeThread;
+    mutex mergeMutex;
+    condition_variable mergeWakeup;
+    bool stopMerging = false; // Guarded by mergeMutex
+
+    // DocSets of frequent terms built at termSetGeneration; emptied once
+    // indexGeneration moves on. Queries fill it under a shared indexMutex,
+    // so it has its own lock.
+    unordered_map<TrieNode *, shared_ptr<const DocSet>> frequentTermSets;
+    unsigned long long termSetGeneration = 0;
+    mutex termSetMutex;
+
+    // Query log feedback: how often each term was searched (ranks
+    // autocomplete) and cached word details for hot terms. Cached entries
+    // are tagged with indexGeneration, which every posting update bumps.
+    unordered_map<string, int> termPopularity;
+    struct CachedDetails
+    {
+        unsigned long long generation;
+        SearchResults details;
+    };
+    unordered_map<string, CachedDetails> detailCache;
+    atomic<unsigned long long> indexGeneration{0};
+
+    void destroyTrie(TrieNode *node)
+    {
+        if (!node)
+            return;
+        for (int i = 0; i < Alphabet::SIZE; i++)
+        {
+            destroyTrie(node->children[i]);
+        }
+        delete node;
+    }
+
+    // findNode for a caller already holding indexMutex
+    TrieNode *findNodeLocked(const char *key)
+    {
+        char normalized[MAX_WORD_LENGTH];
+        int length = 0;
+        for (; key[length] != '\0'; length++)
+        {
+            char ch = Alphabet::keyChar(key[length]);
+            if (ch == '\0' || length >= MAX_WORD_LENGTH - 1)
+                return nullptr;
+            normalized[length] = ch;
+        }
+        normalized[length] = '\0';
+
+        if (!mayContainTermLocked(normalized))
+            return nullptr;
+        TrieNode *node = descend(normalized);
+        return node && node->isEndOfWord ? node : nullptr;
+    }
+
+    // Term filter check; false means the key is definitely not indexed
+    bool mayContainTermLocked(const char *key)
+    {
+        termProbes.fetch_add(1, memory_order_relaxed);
+        if (termFilter.mayContain(key))
+            return true;
+        termRejects.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    // Per-document check; false means fileId definitely lacks the key
+    bool documentMayContainLocked(DocId fileId, const char *key)
+    {
+        documentProbes.fetch_add(1, memory_order_relaxed);
+        if (documentFilters[fileId].mayContain(key))
+            return true;
+        documentRejects.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    // getWordDetails for a caller already holding indexMutex
+    bool getWordDetailsLocked(const char *word, SearchResults &details, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        details.clear();
+        char wordCopy[MAX_WORD_LENGTH];
+        strncpy(wordCopy, word, MAX_WORD_LENGTH);
+        stem(wordCopy);
+
+        auto cached = detailCache.find(word);
+        if (cached != detailCache.end() && cached->second.generation == indexGeneration)
+        {
+            const SearchResults &entry = cached->second.details;
+            budget.spend(entry.hits.size());
+            details.hits.assign(entry.hits.begin(), entry.hits.end());
+            details.term = entry.term;
+            details.totalOccurrences = entry.totalOccurrences;
+            return true;
+        }
+
+        TrieNode *current = findNodeLocked(wordCopy);
+        if (!current)
+            return false;
+
+        details.term = current->word;
+        details.totalOccurrences = current->termFrequency;
+        vector<FileInfo> scratch;
+        const vector<FileInfo> &postings = postingsOfLocked(current, scratch);
+        for (const FileInfo &info : postings)
+        {
+            if (!budget.spend())
+                break;
+            // Deleted files count neither as hits nor as occurrences
+            if (deletedDocuments.contains(info.fileId))
+            {
+                details.totalOccurrences -= info.frequency;
+                continue;
+            }
+            int first = info.positionCount > 0 ? info.positions[0] : -1;
+            int last = info.positionCount > 0 ? info.positions[info.positionCount - 1] : -1;
+            details.add(info.fileId, current->word, info.frequency, first, last);
+        }
+        // A term left only in removed files is not found; a budget cut may
+        // just not have reached its live files yet
+        if (details.hits.empty() && !budget.truncated())
+        {
+            details.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // prefixCursor for a caller already holding indexMutex
+    TrieCursor prefixCursorLocked(const char *prefix, const char *after = nullptr)
+    {
+        TrieCursor cursor;
+        TrieNode *current = descend(prefix);
+        if (!current)
+            return cursor;
+        if (!after)
+        {
+            cursor.reset(current);
+            return cursor;
+        }
+
+        char prefixKey[MAX_WORD_LENGTH], afterKey[MAX_WORD_LENGTH];
+        normalizeKey(prefix, prefixKey);
+        normalizeKey(after, afterKey);
+        size_t prefixLength = strlen(prefixKey);
+        if (strncmp(afterKey, prefixKey, prefixLength) == 0)
+            cursor.seek(current, afterKey + prefixLength);
+        else if (strcmp(afterKey, prefixKey) < 0)
+            cursor.reset(current); // Before the whole range
+        return cursor;             // Otherwise past it: nothing left
+    }
+
+    // Whether a term occurs in some file that has not been removed. The
+    // doc ids decoded to tell are charged to budget.
+    bool hasLiveDocuments(TrieNode *node, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        if (deletedDocuments.empty())
+            return true;
+        vector<uint32_t> docs;
+        termDocIds(node, docs);
+        budget.spend(docs.size());
+        for (uint32_t doc : docs)
+        {
+            if (!deletedDocuments.contains(doc))
+                return true;
+        }
+        return false;
+    }
+
+    // Next term of the cursor, skipping terms found only in removed files
+    bool nextLiveTerm(TrieCursor &cursor, string_view &term, QueryBudget &budget)
+    {
+        while (cursor.next(term, budget))
+        {
+            if (hasLiveDocuments(cursor.node(), budget))
+                return true;
+        }
+        return false;
+    }
+
+    // Copy up to limit terms from the cursor into words
+    void collectWords(TrieCursor &cursor, char words[][MAX_WORD_LENGTH], int &wordCount, int limit,
+                      QueryBudget &budget)
+    {
+        string_view term;
+        while (wordCount < limit && nextLiveTerm(cursor, term, budget))
+        {
+            snprintf(words[wordCount++], MAX_WORD_LENGTH, "%.*s", (int)term.size(), term.data());
+        }
+    }
+
+    int findFileIdInFileInfo(const vector<FileInfo> &postings, DocId fileId)
+    {
+        for (size_t i = 0; i < postings.size(); i++)
+        {
+            if (postings[i].fileId == fileId)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Bring spilled postings back into memory before they are modified.
+    // The old record stays in the file until the next spill rewrites it.
+    void faultInPostings(TrieNode *node)
+    {
+        if (node->postingsOffset >= 0)
+        {
+            postingsFile.decode(node->postingsOffset, node->fileInfo);
+            node->postingsOffset = -1;
+            livePostingsBytes += node->fileInfo.size() * sizeof(FileInfo);
+        }
+    }
+
+    shared_ptr<const SegmentList> segmentSnapshot() const
+    {
+        return atomic_load(&segments);
+    }
+
+    // Whether postings have been flushed out of the trie at all
+    bool hasFlushedPostings() const
+    {
+        return !frozenPostings.empty() || !segmentSnapshot()->empty();
+    }
+
+    // Whether a frozen batch or a segment already holds a posting of the
+    // node's term (key) for fileId
+    bool flushedContain(TrieNode *node, const char *key, DocId fileId)
+    {
+        for (const auto &batch : frozenPostings)
+        {
+            const vector<FileInfo> *postings = batch->find(node);
+            if (postings && findFileIdInFileInfo(*postings, fileId) >= 0)
+                return true;
+        }
+        vector<uint32_t> candidate{fileId}, found;
+        for (const auto &segment : *segmentSnapshot())
+        {
+            long long offset = segment->find(key);
+            if (offset < 0)
+                continue;
+            segment->reader(offset).intersect(candidate, found);
+            if (!found.empty())
+                return true;
+        }
+        return false;
+    }
+
+    // A terminal node's in-memory postings (resident or spilled), without
+    // anything already flushed to segments
+    const vector<FileInfo> &livePostings(TrieNode *node, vector<FileInfo> &scratch)
+    {
+        if (node->postingsOffset < 0)
+            return node->fileInfo;
+        postingsFile.decode(node->postingsOffset, scratch);
+        return scratch;
+    }
+
+    // A terminal node's postings sorted by fileId when segments exist: those
+    // flushed to segments, oldest first, merged with the live ones. Without
+    // segments this is the resident list or the spilled record decoded into
+    // scratch. Caller holds indexMutex.
+    const vector<FileInfo> &postingsOfLocked(TrieNode *node, vector<FileInfo> &scratch)
+    {
+        shared_ptr<const SegmentList> list = segmentSnapshot();
+        if (list->empty() && frozenPostings.empty())
+            return livePostings(node, scratch);
+
+        char key[MAX_WORD_LENGTH];
+        normalizeKey(node->word, key);
+        vector<FileInfo> part;
+        scratch.clear();
+        for (const auto &segment : *list)
+        {
+            long long offset = segment->find(key);
+            if (offset < 0)
+                continue;
+            segment->reader(offset).decode(part);
+            scratch.insert(scratch.end(), part.begin(), part.end());
+        }
+        for (const auto &batch : frozenPostings)
+        {
+            if (const vector<FileInfo> *frozen = batch->find(node))
+                scratch.insert(scratch.end(), frozen->begin(), frozen->end());
+        }
+        const vector<FileInfo> &live = livePostings(node, part);
+        scratch.insert(scratch.end(), live.begin(), live.end());
+        combinePostings(scratch);
+        return scratch;
+    }
+
+    // Move every term's live postings into a frozen batch for the merge
+    // thread to write as a new segment; oldest data stays in older
+    // segments. Only pointers move here, so indexing is not held up by the
+    // encoding or the write. Caller holds indexMutex.
+    void flushLocked()
+    {
+        vector<TrieNode *> terminals;
+        if (postingsFile.mapped())
+            collectTerminals(root, terminals); // Spilled records may belong to any term
+        else
+            terminals.swap(liveTerms);
+        liveTerms.clear();
+
+        auto batch = make_shared<FrozenPostings>();
+        vector<uint32_t> docs;
+        for (TrieNode *node : terminals)
+        {
+            vector<FileInfo> postings;
+            if (node->postingsOffset >= 0)
+                postingsFile.decode(node->postingsOffset, postings);
+            else
+                postings.swap(node->fileInfo);
+            node->postingsOffset = -1;
+            if (postings.empty())
+                continue;
+            for (const FileInfo &info : postings)
+                docs.push_back(info.fileId);
+            batch->index.push_back({node, static_cast<uint32_t>(batch->nodes.size())});
+            batch->nodes.push_back(node);
+            batch->postings.push_back(move(postings));
+        }
+        postingsFile.close();
+        livePostingsBytes = 0;
+        if (batch->nodes.empty())
+            return;
+        sort(batch->index.begin(), batch->index.end());
+
+        sort(docs.begin(), docs.end());
+        docs.erase(unique(docs.begin(), docs.end()), docs.end());
+        flushedDocuments = DocSet::unite(flushedDocuments, DocSet::fromSorted(docs));
+        frozenPostings.push_back(batch);
+        indexGeneration++;
+        flushCount++;
+        mergeWakeup.notify_one();
+    }
+
+    // Write the oldest frozen batches into segments. Each is swapped for
+    // its segment in one step, so readers see its postings exactly once.
+    // Returns false if a segment could not be written; the batch then
+    // stays in memory.
+    bool writeFrozenPostings()
+    {
+        while (true)
+        {
+            shared_ptr<const FrozenPostings> batch;
+            {
+                shared_lock<shared_mutex> lock(indexMutex);
+                if (frozenPostings.empty())
+                    return true;
+                batch = frozenPostings.front();
+            }
+
+            // Segments are written in key order
+            vector<pair<string, uint32_t>> keys;
+            char key[MAX_WORD_LENGTH];
+            for (size_t i = 0; i < batch->nodes.size(); i++)
+            {
+                normalizeKey(batch->nodes[i]->word, key);
+                keys.push_back({key, static_cast<uint32_t>(i)});
+            }
+            sort(keys.begin(), keys.end());
+
+            string path = string(SEGMENT_DIRECTORY) + "/segment-" + to_string(nextSegmentNumber++) + ".seg";
+            IndexSegment::Writer writer(path);
+            vector<FileInfo> sorted;
+            for (const auto &entry : keys)
+            {
+                sorted = batch->postings[entry.second];
+                sort(sorted.begin(), sorted.end(), [](const FileInfo &a, const FileInfo &b)
+                     { return a.fileId < b.fileId; });
+                writer.add(entry.first, sorted);
+            }
+            auto segment = make_shared<IndexSegment>();
+            if (!writer.finish() || !segment->open(path, 0))
+            {
+                segment->markObsolete();
+                return false;
+            }
+
+            lock_guard<shared_mutex> lock(indexMutex);
+            auto list = make_shared<SegmentList>(*segmentSnapshot());
+            list->push_back(segment);
+            atomic_store(&segments, shared_ptr<const SegmentList>(list));
+            frozenPostings.erase(frozenPostings.begin());
+        }
+    }
+
+    void flushIfOverBudget()
+    {
+        if (memoryBudget > 0 && livePostingsBytes > memoryBudget)
+            flushLocked();
+    }
+
+    // Oldest run of SEGMENT_MERGE_FANOUT adjacent segments in the same tier,
+    // as [first, first + FANOUT); -1 if there is none. Only adjacent runs are
+    // merged so the list stays ordered oldest first.
+    static int mergeCandidate(const SegmentList &list)
+    {
+        for (size_t first = 0; first + SEGMENT_MERGE_FANOUT <= list.size(); first++)
+        {
+            int tier = list[first]->tier();
+            size_t i = first + 1;
+            while (i < first + SEGMENT_MERGE_FANOUT && list[i]->tier() == tier)
+                i++;
+            if (i == first + SEGMENT_MERGE_FANOUT)
+                return first;
+        }
+        return -1;
+    }
+
+    // Background segment writing and tiered merging. Segments are written
+    // without holding indexMutex; only swapping the segment list takes it.
+    void mergeLoop()
+    {
+        int failedAtFlush = -1; // After a failed write, wait for the next flush to retry
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(mergeMutex);
+                // Timed wait, so a flush notifying between checks is never lost
+                mergeWakeup.wait_for(lock, chrono::milliseconds(200));
+                if (stopMerging)
+                    return;
+            }
+
+            int flushes = flushCount;
+            if (flushes != failedAtFlush && !writeFrozenPostings())
+            {
+                cerr << "Warning: could not write index segment; keeping postings in memory" << endl;
+                failedAtFlush = flushes;
+            }
+
+            int first;
+            shared_ptr<const SegmentList> snapshot;
+            while ((first = mergeCandidate(*(snapshot = segmentSnapshot()))) >= 0)
+            {
+                SegmentList inputs(snapshot->begin() + first, snapshot->begin() + first + SEGMENT_MERGE_FANOUT);
+                string path = string(SEGMENT_DIRECTORY) + "/segment-" + to_string(nextSegmentNumber++) + ".seg";
+                shared_ptr<IndexSegment> merged = mergeSegments(inputs, path);
+                if (!merged)
+                {
+                    cerr << "Warning: segment merge failed; keeping the original segments" << endl;
+                    break;
+                }
+
+                {
+                    lock_guard<shared_mutex> lock(indexMutex);
+                    // Only this thread removes segments, so the run is still in
+                    // place; flushes may have appended newer ones after it
+                    auto list = make_shared<SegmentList>(*segmentSnapshot());
+                    list->erase(list->begin() + first, list->begin() + first + SEGMENT_MERGE_FANOUT);
+                    list->insert(list->begin() + first, merged);
+                    atomic_store(&segments, shared_ptr<const SegmentList>(list));
+                }
+                for (const auto &segment : inputs)
+                    segment->markObsolete();
+                mergeCount++;
+
+                {
+                    lock_guard<mutex> stopLock(mergeMutex);
+                    if (stopMerging)
+                        return;
+                }
+            }
+        }
+    }
+
+    // One hit per live document of node, tagged with its term
+    void addTermHits(TrieNode *node, SearchResults &results, QueryBudget &budget)
+    {
+        vector<FileInfo> scratch;
+        const vector<FileInfo> &postings = postingsOfLocked(node, scratch);
+        budget.spend(postings.size());
+        for (const FileInfo &info : postings)
+        {
+            if (deletedDocuments.contains(info.fileId))
+                continue;
+            int first = info.positionCount > 0 ? info.positions[0] : -1;
+            int last = info.positionCount > 0 ? info.positions[info.positionCount - 1] : -1;
+            results.add(info.fileId, node->word, info.frequency, first, last);
+        }
+    }
+
+    bool addTermListHits(const vector<string> &terms, SearchResults &results, QueryBudget &budget)
+    {
+        // At most MAX_RESULTS terms: charged, but finished even past the
+        // budget so terms already matched are shown
+        for (const string &term : terms)
+        {
+            budget.spend();
+            TrieNode *node = descend(term.c_str());
+            if (node && node->isEndOfWord)
+                addTermHits(node, results, budget);
+        }
+        return !results.hits.empty();
+    }
+
+    // Wildcard matching runs the pattern as an NFA alongside a trie walk.
+    // Each bit in the state set is a pattern position still alive at this
+    // node; branches where the set becomes empty are never entered.
+    typedef bitset<MAX_WORD_LENGTH + 1> PatternStates;
+
+    static void closeOverStars(const char *pattern, int length, PatternStates &states)
+    {
+        // A '*' may match nothing, so the position after it is also alive
+        for (int p = 0; p < length; p++)
+        {
+            if (states[p] && pattern[p] == '*')
+                states[p + 1] = true;
+        }
+    }
+
+    void wildcardWalk(TrieNode *node, const char *pattern, int length, const PatternStates &states,
+                      vector<TrieNode *> &matches, size_t limit, QueryBudget &budget)
+    {
+        if (!budget.spend())
+            return;
+        if (node->isEndOfWord && states[length])
+        {
+            matches.push_back(node);
+        }
+
+        // Which children can any live position consume?
+        bool anyChar = false;
+        bool literal[Alphabet::SIZE] = {false};
+        for (int p = 0; p < length; p++)
+        {
+            if (!states[p])
+                continue;
+            if (pattern[p] == '*' || pattern[p] == '?')
+                anyChar = true;
+            else
+                literal[Alphabet::slot(pattern[p])] = true;
+        }
+
+        for (int i = 0; i < Alphabet::SIZE && matches.size() < limit; i++)
+        {
+            if (!node->children[i] || !(anyChar || literal[i]))
+                continue;
+
+            char ch = Alphabet::symbol(i);
+            PatternStates next;
+            for (int p = 0; p < length; p++)
+            {
+                if (!states[p])
+                    continue;
+                if (pattern[p] == '*')
+                    next[p] = true;
+                else if (pattern[p] == '?' || pattern[p] == ch)
+                    next[p + 1] = true;
+            }
+            closeOverStars(pattern, length, next);
+            if (next.any())
+            {
+                wildcardWalk(node->children[i], pattern, length, next, matches, limit, budget);
+            }
+        }
+    }
+
+    // Node reached by following prefix through child pointers
+    TrieNode *descendPointers(const char *prefix)
+    {
+        TrieNode *current = root;
+        for (int i = 0; prefix[i] != '\0'; i++)
+        {
+            int slot = Alphabet::slot(prefix[i]);
+            if (slot < 0)
+                return nullptr;
+
+            current = current->children[slot];
+            if (!current)
+                return nullptr;
+        }
+        return current;
+    }
+
+    // Node reached by prefix, using a frozen layout when one is built
+    TrieNode *descend(const char *prefix)
+    {
+        if (packedTrie.built())
+        {
+            int32_t index = packedTrie.walk(prefix);
+            return index < 0 ? nullptr : packedTrie.nodeAt(index);
+        }
+        if (doubleArray.built())
+        {
+            int32_t state = doubleArray.walk(prefix);
+            return state < 0 ? nullptr : doubleArray.nodeAt(state);
+        }
+        return descendPointers(prefix);
+    }
+
+    void collectTerminals(TrieNode *node, vector<TrieNode *> &terminals)
+    {
+        if (node->isEndOfWord)
+        {
+            terminals.push_back(node);
+        }
+        for (int i = 0; i < Alphabet::SIZE; i++)
+        {
+            if (node->children[i])
+            {
+                collectTerminals(node->children[i], terminals);
+            }
+        }
+    }
+
+    size_t countNodes(TrieNode *node)
+    {
+        size_t count = 1;
+        for (int i = 0; i < Alphabet::SIZE; i++)
+        {
+            if (node->children[i])
+            {
+                count += countNodes(node->children[i]);
+            }
+        }
+        return count;
+    }
+
+    void collectVocabulary(TrieNode *node, vector<string> &words, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        if (!budget.spend())
+            return;
+        if (node->isEndOfWord)
+        {
+            words.push_back(node->word);
+        }
+        for (int i = 0; i < Alphabet::SIZE; i++)
+        {
+            if (node->children[i])
+            {
+                collectVocabulary(node->children[i], words, budget);
+            }
+        }
+    }
+
+    // Lowercase and drop characters outside the alphabet, giving the key
+    // the trie path spells out
+    static void normalizeKey(const char *word, char *key)
+    {
+        int j = 0;
+        for (int i = 0; word[i] && j < MAX_WORD_LENGTH - 1; i++)
+        {
+            char ch = Alphabet::keyChar(word[i]);
+            if (ch != '\0')
+                key[j++] = ch;
+        }
+        key[j] = '\0';
+    }
+
+    void addDocumentTerms(TrieNode *node, vector<size_t> *counts)
+    {
+        if (node->isEndOfWord)
+        {
+            char key[MAX_WORD_LENGTH];
+            normalizeKey(node->word, key);
+            // Order does not matter here, so resident postings are read directly
+            vector<uint32_t> docs;
+            if (node->postingsOffset < 0 && !hasFlushedPostings())
+            {
+                for (const FileInfo &info : node->fileInfo)
+                    docs.push_back(info.fileId);
+            }
+            else
+            {
+                termDocIds(node, docs);
+            }
+            if (counts)
+            {
+                (*counts)[0]++;
+                for (uint32_t doc : docs)
+                    (*counts)[doc + 1]++;
+            }
+            else
+            {
+                termFilter.add(key);
+                for (uint32_t doc : docs)
+                    documentFilters[doc].add(key);
+            }
+        }
+        for (int i = 0; i < Alphabet::SIZE; i++)
+        {
+            if (node->children[i])
+                addDocumentTerms(node->children[i], counts);
+        }
+    }
+
+    // Resize every filter to twice its current content and refill it from
+    // the trie. Only a new false-positive rate needs this; filters grow by
+    // themselves as terms arrive. Caller holds indexMutex.
+    void rebuildBloomFiltersLocked()
+    {
+        vector<size_t> counts(documentFilters.size() + 1, 0);
+        addDocumentTerms(root, &counts);
+
+        termFilter.configure(max(BLOOM_INITIAL_TERMS, counts[0] * 2), bloomFalsePositiveRate);
+        for (size_t i = 0; i < documentFilters.size(); i++)
+        {
+            documentFilters[i].configure(max(BLOOM_INITIAL_DOCUMENT_TERMS, counts[i + 1] * 2), bloomFalsePositiveRate);
+        }
+        addDocumentTerms(root, nullptr);
+    }
+
+    // Walk to (creating as needed) the terminal node for an already cleaned word
+    TrieNode *insertNode(const char *word)
+    {
+        TrieNode *current = root;
+
+        for (int i = 0; word[i]; i++)
+        {
+            int index = Alphabet::slot(word[i]);
+            if (index < 0)
+            {
+                continue;
+            }
+            if (!current->children[index])
+            {
+                current->children[index] = new TrieNode();
+                if (current->children[index] == nullptr)
+                {
+                    cerr << "Memory allocation failed!" << endl;
+                    exit(1);
+                }
+                doubleArray.clear();
+                packedTrie.clear();
+            }
+            current = current->children[index];
+        }
+
+        bool newTerm = !current->isEndOfWord;
+        if (newTerm)
+        {
+            doubleArray.clear();
+            packedTrie.clear();
+            termFst.clear();
+            fstPostings.clear();
+        }
+        current->isEndOfWord = true;
+        if (strlen(current->word) == 0)
+        {
+            strncpy(current->word, word, MAX_WORD_LENGTH);
+        }
+        if (newTerm)
+        {
+            char key[MAX_WORD_LENGTH];
+            normalizeKey(word, key);
+            termFilter.add(key);
+            if (deletionIndex.enabled())
+                deletionIndex.add(key);
+            affixIndex.add(key);
+        }
+        return current;
+    }
+
+    // Find or create the posting for fileId on a terminal node
+    FileInfo &postingFor(TrieNode *node, DocId fileId)
+    {
+        indexGeneration++;
+        if (node->fileInfo.empty() && node->postingsOffset < 0)
+            liveTerms.push_back(node);
+        faultInPostings(node);
+        int fileIndex = findFileIdInFileInfo(node->fileInfo, fileId);
+        if (fileIndex == -1)
+        {
+            fileIndex = node->fileInfo.size();
+            node->fileInfo.push_back({fileId, 0, 0});
+            livePostingsBytes += sizeof(FileInfo);
+
+            // A document split by a flush is already counted in a segment
+            char key[MAX_WORD_LENGTH];
+            normalizeKey(node->word, key);
+            if (!flushedDocuments.contains(fileId) || !flushedContain(node, key, fileId))
+                node->fileInfoCount++;
+            documentFilters[fileId].add(key);
+        }
+        return node->fileInfo[fileIndex];
+    }
+
+    // Sorted ids of the documents containing a term
+    void termDocIds(TrieNode *node, vector<uint32_t> &docs)
+    {
+        docs.clear();
+        shared_ptr<const SegmentList> list = segmentSnapshot();
+        if (node->postingsOffset >= 0 && !hasFlushedPostings())
+        {
+            postingsFile.reader(node->postingsOffset).decodeDocs(docs);
+            return;
+        }
+
+        // Only the doc id blocks of segment and spilled records are decoded
+        vector<uint32_t> part;
+        if (!list->empty())
+        {
+            char key[MAX_WORD_LENGTH];
+            normalizeKey(node->word, key);
+            for (const auto &segment : *list)
+            {
+                long long offset = segment->find(key);
+                if (offset < 0)
+                    continue;
+                segment->reader(offset).decodeDocs(part);
+                docs.insert(docs.end(), part.begin(), part.end());
+            }
+        }
+        for (const auto &batch : frozenPostings)
+        {
+            if (const vector<FileInfo> *frozen = batch->find(node))
+            {
+                for (const FileInfo &info : *frozen)
+                    docs.push_back(info.fileId);
+            }
+        }
+        if (node->postingsOffset >= 0)
+        {
+            postingsFile.reader(node->postingsOffset).decodeDocs(part);
+            docs.insert(docs.end(), part.begin(), part.end());
+        }
+        for (const FileInfo &info : node->fileInfo)
+            docs.push_back(info.fileId);
+        sort(docs.begin(), docs.end());
+        docs.erase(unique(docs.begin(), docs.end()), docs.end());
+    }
+
+    // A term's documents as a DocSet; frequent terms' sets are cached until
+    // the index changes. Shared so a set stays valid while another query
+    // replaces its cache entry.
+    shared_ptr<const DocSet> termDocSet(TrieNode *node)
+    {
+        vector<uint32_t> docs;
+        if (node->fileInfoCount < FREQUENT_TERM_DOCUMENTS)
+        {
+            termDocIds(node, docs);
+            return make_shared<const DocSet>(DocSet::fromSorted(docs));
+        }
+
+        unsigned long long generation = indexGeneration;
+        {
+            lock_guard<mutex> lock(termSetMutex);
+            if (termSetGeneration != generation)
+            {
+                // Every cached set is stale; drop them rather than let them pile up
+                frequentTermSets.clear();
+                termSetGeneration = generation;
+            }
+            auto cached = frequentTermSets.find(node);
+            if (cached != frequentTermSets.end())
+                return cached->second;
+        }
+        // Built outside termSetMutex; two queries may both build it, one wins
+        termDocIds(node, docs);
+        auto set = make_shared<const DocSet>(DocSet::fromSorted(docs));
+        lock_guard<mutex> lock(termSetMutex);
+        if (termSetGeneration == generation)
+            frequentTermSets[node] = set;
+        return set;
+    }
+
+    // Documents containing every required term and no excluded one. Rare
+    // terms are intersected as sorted lists, probing spilled ones in their
+    // compressed blocks; frequent terms are then applied as DocSets.
+    DocSet evaluateGroup(const vector<TrieNode *> &required, const DocSet &excluded)
+    {
+        vector<TrieNode *> rare, frequent;
+        for (TrieNode *node : required)
+            (node->fileInfoCount < FREQUENT_TERM_DOCUMENTS ? rare : frequent).push_back(node);
+        sort(rare.begin(), rare.end(), [](TrieNode *a, TrieNode *b)
+             { return a->fileInfoCount < b->fileInfoCount; });
+
+        DocSet result;
+        if (rare.empty() && frequent.empty())
+        {
+            result = DocSet::range(0, documents.size());
+        }
+        else if (rare.empty())
+        {
+            result = *termDocSet(frequent[0]);
+            frequent.erase(frequent.begin());
+        }
+        else
+        {
+            vector<uint32_t> matches, docs, next;
+            bool segmented = hasFlushedPostings();
+            termDocIds(rare[0], matches);
+            for (size_t i = 1; i < rare.size() && !matches.empty(); i++)
+            {
+                if (rare[i]->postingsOffset >= 0 && !segmented)
+                {
+                    postingsFile.reader(rare[i]->postingsOffset).intersect(matches, next);
+                }
+                else
+                {
+                    termDocIds(rare[i], docs);
+                    next.clear();
+                    set_intersection(matches.begin(), matches.end(), docs.begin(), docs.end(), back_inserter(next));
+                }
+                matches.swap(next);
+            }
+            result = DocSet::fromSorted(matches);
+        }
+
+        for (size_t i = 0; i < frequent.size() && !result.empty(); i++)
+            result = DocSet::intersect(result, *termDocSet(frequent[i]));
+        return DocSet::subtract(result, excluded);
+    }
+
+    // Whole index as: "IDXSNAP2", the uint16-length name of the alphabet
+    // its keys use, uint32 document count, per document a
+    // uint16-length path and a status byte (0 live, 1 deleted, 2 still
+    // being indexed: its postings and trigrams are left out, and recovery
+    // indexes it again); uint32 term count, per term a
+    // uint16-length word, uint32 record size and CompressedPostings record;
+    // a trigram flag with optional trigram lists; CRC-32 of all of it.
+    // Written to a temporary file and renamed into place.
+    bool saveSnapshotLocked(const char *path)
+    {
+        vector<uint8_t> out;
+        auto write = [&out](const void *value, size_t bytes)
+        {
+            const uint8_t *data = static_cast<const uint8_t *>(value);
+            out.insert(out.end(), data, data + bytes);
+        };
+        auto writeString = [&write](const char *text)
+        {
+            uint16_t length = min<size_t>(strlen(text), UINT16_MAX);
+            write(&length, sizeof(length));
+            write(text, length);
+        };
+
+        write("IDXSNAP2", 8);
+        writeString(Alphabet::NAME);
+        uint32_t documentCount = documents.size();
+        write(&documentCount, sizeof(documentCount));
+        for (DocId id = 0; id < documentCount; id++)
+        {
+            writeString(documents.path(id));
+            uint8_t status = pendingDocuments.count(id) ? 2 : deletedDocuments.contains(id);
+            write(&status, sizeof(status));
+        }
+        auto pending = [this](DocId id)
+        {
+            return pendingDocuments.count(id) > 0;
+        };
+
+        // The count is patched in once terms left empty by pending documents are skipped
+        vector<TrieNode *> terminals;
+        collectTerminals(root, terminals);
+        size_t termCountOffset = out.size();
+        uint32_t termCount = 0;
+        write(&termCount, sizeof(termCount));
+        vector<FileInfo> scratch, sorted;
+        vector<uint8_t> record;
+        for (TrieNode *node : terminals)
+        {
+            sorted = postingsOfLocked(node, scratch);
+            if (!pendingDocuments.empty())
+            {
+                sorted.erase(remove_if(sorted.begin(), sorted.end(), [&](const FileInfo &info)
+                                       { return pending(info.fileId); }),
+                             sorted.end());
+                if (sorted.empty())
+                    continue;
+            }
+            termCount++;
+            sort(sorted.begin(), sorted.end(), [](const FileInfo &a, const FileInfo &b)
+                 { return a.fileId < b.fileId; });
+            record.clear();
+            CompressedPostings::encode(sorted, record);
+            uint32_t recordBytes = record.size();
+            writeString(node->word);
+            write(&recordBytes, sizeof(recordBytes));
+            write(record.data(), recordBytes);
+        }
+        memcpy(&out[termCountOffset], &termCount, sizeof(termCount));
+
+        uint8_t hasTrigrams = trigramIndex.enabled();
+        write(&hasTrigrams, sizeof(hasTrigrams));
+        if (hasTrigrams)
+        {
+            uint32_t gramCount = trigramIndex.allPostings().size();
+            write(&gramCount, sizeof(gramCount));
+            vector<DocId> docs;
+            for (const auto &entry : trigramIndex.allPostings())
+            {
+                docs.clear();
+                copy_if(entry.second.begin(), entry.second.end(), back_inserter(docs), [&](DocId id)
+                        { return !pending(id); });
+                uint32_t docCount = docs.size();
+                write(&entry.first, sizeof(entry.first));
+                write(&docCount, sizeof(docCount));
+                write(docs.data(), docCount * sizeof(DocId));
+            }
+        }
+        uint32_t crc = crc32(out.data(), out.size());
+        write(&crc, sizeof(crc));
+
+        string tempPath = string(path) + ".tmp";
+        FILE *file = fopen(tempPath.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = fwrite(out.data(), 1, out.size(), file) == out.size() && fflush(file) == 0 &&
+                  fsync(fileno(file)) == 0;
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(tempPath.c_str(), path) != 0)
+        {
+            remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Register filename, under a new id if replace is set (caller holds indexMutex)
+    DocId addFileLocked(const char *filename, bool replace = false)
+    {
+        DocId id = replace ? documents.replace(filename) : documents.add(filename);
+        if (id == documentFilters.size())
+        {
+            pendingDocuments.insert(id);
+            documentFilters.emplace_back();
+            documentFilters.back().configure(BLOOM_INITIAL_DOCUMENT_TERMS, bloomFalsePositiveRate);
+            documentFilters.back().setGrowable();
+        }
+        return id;
+    }
+
+    // insertPostings for a caller already holding indexMutex
+    void insertPostingsLocked(const char *word, DocId fileId, int frequency, const int *positions, int positionCount)
+    {
+        TrieNode *node = insertNode(word);
+        FileInfo &info = postingFor(node, fileId);
+        info.frequency += frequency;
+        node->termFrequency += frequency;
+        for (int i = 0; i < positionCount && info.positionCount < MAX_WORD_LENGTH; i++)
+        {
+            info.positions[info.positionCount++] = positions[i];
+        }
+        flushIfOverBudget();
+    }
+
+public:
+    BasicTrie() : bloomFalsePositiveRate(DEFAULT_BLOOM_FALSE_POSITIVE_RATE), termProbes(0), termRejects(0), documentProbes(0), documentRejects(0)
+    {
+        root = new TrieNode();
+        termFilter.setGrowable();
+        rebuildBloomFiltersLocked();
+    }
+
+    ~BasicTrie()
+    {
+        if (mergeThread.joinable())
+        {
+            {
+                lock_guard<mutex> lock(mergeMutex);
+                stopMerging = true;
+            }
+            mergeWakeup.notify_one();
+            mergeThread.join();
+        }
+        // Segments only live as long as the index does
+        for (const auto &segment : *segmentSnapshot())
+            segment->markObsolete();
+        destroyTrie(root);
+    }
+
+    // Improved stemming algorithm
+    void stem(char *word)
+    {
+        int length = strlen(word);
+
+        // Basic Porter stemming algorithm (simplified)
+        if (length > 3)
+        {
+            // Handle -ing suffix
+            if (strcmp(word + length - 3, "ing") == 0)
+            {
+                word[length - 3] = '\0';
+                // If word ends with double letter after removing 'ing', remove one
+                length = strlen(word);
+                if (length >= 2 && word[length - 1] == word[length - 2])
+                {
+                    word[length - 1] = '\0';
+                }
+            }
+            // Handle -ed suffix
+            else if (length > 2 && strcmp(word + length - 2, "ed") == 0)
+            {
+                word[length - 2] = '\0';
+                // If word ends with double letter after removing 'ed', remove one
+                length = strlen(word);
+                if (length >= 2 && word[length - 1] == word[length - 2])
+                {
+                    word[length - 1] = '\0';
+                }
+            }
+            // Handle -ies suffix (plurals like "stories" -> "story")
+            else if (length > 3 && strcmp(word + length - 3, "ies") == 0)
+            {
+                word[length - 3] = 'y';
+                word[length - 2] = '\0';
+            }
+            // Handle -es suffix
+            else if (length > 2 && strcmp(word + length - 2, "es") == 0)
+            {
+                word[length - 2] = '\0';
+            }
+            // Handle regular plural -s
+            else if (length > 1 && word[length - 1] == 's' &&
+                     word[length - 2] != 's' && word[length - 2] != 'i')
+            {
+                word[length - 1] = '\0';
+            }
+        }
+    }
+
+    bool isStopWord(const char *word)
+    {
+        const char *stopWords[] = {"the", "a", "is", "of", "and", "in", "to", "it", "that", "for"};
+        for (int i = 0; i < 10; i++)
+        {
+            if (strcmp(stopWords[i], word) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Insert one occurrence of word; position is 1-based, 0 means unknown
+    void insert(const char *word, DocId fileId, int position = 0)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+
+        TrieNode *node = insertNode(word);
+        FileInfo &info = postingFor(node, fileId);
+        info.frequency++;
+        node->termFrequency++;
+        if (position > 0 && info.positionCount < MAX_WORD_LENGTH)
+        {
+            info.positions[info.positionCount++] = position;
+        }
+        flushIfOverBudget();
+    }
+
+    // Merge postings gathered elsewhere (e.g. by a chunk thread) for one word.
+    // Positions must be ascending and later than any already recorded for fileId.
+    void insertPostings(const char *word, DocId fileId, int frequency, const int *positions, int positionCount)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        insertPostingsLocked(word, fileId, frequency, positions, positionCount);
+    }
+
+    // Called once a document is fully indexed: its Bloom filter is shrunk
+    // to the terms it ended up with and stops keeping key hashes
+    void finishDocument(DocId fileId)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        documentFilters[fileId].seal();
+        pendingDocuments.erase(fileId);
+    }
+
+    bool search(const char *word)
+    {
+        char wordCopy[MAX_WORD_LENGTH];
+        strncpy(wordCopy, word, MAX_WORD_LENGTH);
+
+        // Apply stemming to the search word
+        stem(wordCopy);
+
+        // Terms left only in removed files are not found
+        shared_lock<shared_mutex> lock(indexMutex);
+        TrieNode *node = findNodeLocked(wordCopy);
+        return node && hasLiveDocuments(node);
+    }
+
+    // Register a file, returning its id. New files are logged to the
+    // write-ahead log, if one is attached, before indexing continues.
+    DocId addFile(const char *filename)
+    {
+        DocId id;
+        unsigned long long sequence = 0;
+        {
+            lock_guard<shared_mutex> lock(indexMutex);
+            size_t known = documents.size();
+            id = addFileLocked(filename);
+            if (writeAheadLog && documents.size() > known)
+                sequence = writeAheadLog->append(WriteAheadLog::ADD_DOCUMENT, filename);
+        }
+        if (sequence && !writeAheadLog->commit(sequence))
+            cerr << "Warning: could not write to the write-ahead log" << endl;
+        return id;
+    }
+
+    // Register filename under a new id so changed content can be indexed
+    // afresh; its old id is tombstoned. Logged as a removal and an addition.
+    DocId replaceFile(const char *filename)
+    {
+        DocId id;
+        unsigned long long sequence = 0;
+        {
+            lock_guard<shared_mutex> lock(indexMutex);
+            long long old = documents.find(filename);
+            if (old >= 0 && !deletedDocuments.contains(old))
+            {
+                deletedDocuments.add(old);
+                deletedDocuments.runOptimize();
+                indexGeneration++;
+                if (writeAheadLog)
+                    sequence = writeAheadLog->append(WriteAheadLog::REMOVE_DOCUMENT, filename);
+            }
+            id = addFileLocked(filename, true);
+            if (writeAheadLog)
+                sequence = writeAheadLog->append(WriteAheadLog::ADD_DOCUMENT, filename);
+        }
+        if (sequence && !writeAheadLog->commit(sequence))
+            cerr << "Warning: could not write to the write-ahead log" << endl;
+        return id;
+    }
+
+    // Id of an already registered file, or -1
+    long long findFileId(const char *filename)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return documents.find(filename);
+    }
+
+    // Terminal node for an already stemmed word, or nullptr if not indexed.
+    // Nodes live as long as the trie; their postings need the lock (see postingsOf).
+    TrieNode *findNode(const char *key)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return findNodeLocked(key);
+    }
+
+    // Same lookup without the double-array, for benchmarking
+    TrieNode *findNodePointers(const char *key)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        TrieNode *node = descendPointers(key);
+        return node && node->isEndOfWord ? node : nullptr;
+    }
+
+    // Change the target false-positive rate and rebuild every filter
+    void setBloomFalsePositiveRate(double rate)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        bloomFalsePositiveRate = rate;
+        rebuildBloomFiltersLocked();
+    }
+
+    void printBloomStats()
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+
+        size_t documentBytes = 0;
+        double worstDocumentRate = 0;
+        for (size_t i = 0; i < documentFilters.size(); i++)
+        {
+            documentBytes += documentFilters[i].memoryBytes();
+            worstDocumentRate = max(worstDocumentRate, documentFilters[i].estimatedFalsePositiveRate());
+        }
+
+        cout << "Target false-positive rate: " << bloomFalsePositiveRate * 100 << "%\n";
+        cout << "Term filter: " << termFilter.size() << "/" << termFilter.getCapacity() << " terms, "
+             << termFilter.getBitCount() << " bits, " << termFilter.getHashCount() << " hashes, "
+             << "estimated false-positive rate " << termFilter.estimatedFalsePositiveRate() * 100 << "%\n";
+        cout << "Document filters: " << documents.size() << " documents, " << documentBytes
+             << " bytes, worst estimated false-positive rate " << worstDocumentRate * 100 << "%\n";
+        cout << "Term lookups: " << termProbes << ", rejected by filter: " << termRejects << "\n";
+        cout << "Document checks: " << documentProbes << ", skipped by filter: " << documentRejects << "\n";
+    }
+
+    // Build the deletion index over the current vocabulary; later inserts
+    // keep it up to date. Returns the build time in microseconds.
+    long long enableDeletionIndex(int maxDistance, int prefixLength)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        auto start = chrono::steady_clock::now();
+
+        deletionIndex.configure(maxDistance, prefixLength);
+        vector<string> words;
+        collectVocabulary(root, words);
+        for (const auto &word : words)
+        {
+            char key[MAX_WORD_LENGTH];
+            normalizeKey(word.c_str(), key);
+            deletionIndex.add(key);
+        }
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    }
+
+    const DeletionIndex &getDeletionIndex()
+    {
+        return deletionIndex;
+    }
+
+    // All indexed words in lexicographic order
+    void getVocabulary(vector<string> &words)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        words.clear();
+        collectVocabulary(root, words);
+    }
+
+    // Freeze the current trie into a double-array for faster lookups.
+    // Any insert that adds a word drops it again until the next build.
+    void buildDoubleArray()
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        doubleArray.build(root);
+    }
+
+    const DoubleArray &getDoubleArray()
+    {
+        return doubleArray;
+    }
+
+    // A terminal node's postings (see postingsOfLocked), copied into
+    // scratch so they stay valid once the lock is released
+    const vector<FileInfo> &postingsOf(TrieNode *node, vector<FileInfo> &scratch)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        const vector<FileInfo> &postings = postingsOfLocked(node, scratch);
+        if (&postings != &scratch)
+            scratch = postings;
+        return scratch;
+    }
+
+    // Flush live postings into an on-disk segment whenever they outgrow
+    // budgetBytes (0 disables flushing), merging segments in the background.
+    // Segment files go to SEGMENT_DIRECTORY, which is cleared first.
+    bool setMemoryBudget(size_t budgetBytes)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        memoryBudget = budgetBytes;
+        if (budgetBytes == 0 || mergeThread.joinable())
+            return true;
+
+        error_code error;
+        fs::create_directories(SEGMENT_DIRECTORY, error);
+        for (const auto &entry : fs::directory_iterator(SEGMENT_DIRECTORY, error))
+        {
+            if (entry.path().extension() == ".seg")
+                fs::remove(entry.path(), error);
+        }
+        if (error)
+        {
+            memoryBudget = 0;
+            return false;
+        }
+        mergeThread = thread(&BasicTrie::mergeLoop, this);
+        return true;
+    }
+
+    // Flush whatever is live now, e.g. once indexing finishes; the merge
+    // thread writes it to disk shortly after
+    void flushSegment()
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        flushLocked();
+    }
+
+    struct SegmentStats
+    {
+        size_t budget, liveBytes;
+        int flushes, merges;
+        vector<pair<int, size_t>> segments; // (tier, bytes), oldest first
+    };
+
+    SegmentStats getSegmentStats()
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        SegmentStats stats{memoryBudget, livePostingsBytes, flushCount, mergeCount, {}};
+        for (const auto &segment : *segmentSnapshot())
+            stats.segments.push_back({segment->tier(), segment->bytes()});
+        return stats;
+    }
+
+    // Move every term's postings into a fresh memory-mapped postings file
+    // and free the in-memory copies. Postings already on disk are carried
+    // over; later inserts fault the affected terms back into memory.
+    // Returns the number of terms written, or -1 on failure.
+    long long spillPostings(const char *path)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        vector<TrieNode *> terminals;
+        collectTerminals(root, terminals);
+
+        string tempPath = string(path) + ".tmp";
+        FILE *file = fopen(tempPath.c_str(), "wb");
+        if (!file)
+            return -1;
+
+        vector<long long> offsets;
+        vector<FileInfo> scratch;
+        bool ok = true;
+        for (TrieNode *node : terminals)
+        {
+            offsets.push_back(ftell(file));
+            ok = ok && PostingsFile::encode(file, livePostings(node, scratch));
+        }
+        ok = fclose(file) == 0 && ok;
+        if (!ok)
+        {
+            remove(tempPath.c_str());
+            return -1;
+        }
+
+        // Nothing may still point into the old mapping once it is replaced
+        for (TrieNode *node : terminals)
+            faultInPostings(node);
+        postingsFile.close();
+        if (rename(tempPath.c_str(), path) != 0 || !postingsFile.open(path))
+            return -1;
+
+        for (size_t i = 0; i < terminals.size(); i++)
+        {
+            terminals[i]->postingsOffset = offsets[i];
+            vector<FileInfo>().swap(terminals[i]->fileInfo);
+        }
+        livePostingsBytes = 0;
+        return terminals.size();
+    }
+
+    // Bytes held by resident (not spilled) postings
+    size_t residentPostingsBytes()
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        vector<TrieNode *> terminals;
+        collectTerminals(root, terminals);
+        size_t bytes = 0;
+        for (TrieNode *node : terminals)
+            bytes += node->fileInfo.capacity() * sizeof(FileInfo);
+        return bytes;
+    }
+
+    const PostingsFile &getPostingsFile()
+    {
+        return postingsFile;
+    }
+
+    // Lay the trie out again for cache locality (see PackedTrie). Lookups use
+    // the packed layout until an insert adds a word.
+    void buildPackedLayout(int blockDepth)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        packedTrie.build(root, blockDepth);
+    }
+
+    const PackedLayout &getPackedLayout()
+    {
+        return packedTrie;
+    }
+
+    // Build a packed layout of the current trie into layout, leaving the
+    // one lookups use alone (for comparing layouts)
+    void buildPackedLayoutCopy(PackedLayout &layout, int blockDepth)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        layout.build(root, blockDepth);
+    }
+
+    // Addresses read by a pointer-trie lookup of word, for cache simulation
+    TrieNode *tracePointerLookup(const char *word, vector<const void *> &trace)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        TrieNode *current = root;
+        for (int i = 0; word[i] && current; i++)
+        {
+            int index = Alphabet::slot(word[i]);
+            if (index < 0)
+                return nullptr;
+            trace.push_back(&current->children[index]);
+            current = current->children[index];
+        }
+        if (current)
+            trace.push_back(&current->isEndOfWord);
+        return current;
+    }
+
+    // Build the FST term dictionary. Trie order is already sorted, so each
+    // term's output is its offset into the postings table.
+    void buildFst()
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+
+        fstPostings.clear();
+        collectTerminals(root, fstPostings);
+
+        vector<string> terms;
+        vector<uint64_t> offsets;
+        terms.reserve(fstPostings.size());
+        offsets.reserve(fstPostings.size());
+        for (size_t i = 0; i < fstPostings.size(); i++)
+        {
+            terms.push_back(fstPostings[i]->word);
+            offsets.push_back(i);
+        }
+        termFst.build(terms, offsets);
+    }
+
+    const FstDictionary &getFst()
+    {
+        return termFst;
+    }
+
+    // Postings node for an FST output
+    TrieNode *fstPostingsAt(uint64_t offset)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return offset < fstPostings.size() ? fstPostings[offset] : nullptr;
+    }
+
+    size_t getNodeCount()
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return countNodes(root);
+    }
+
+    int getFileCount()
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return documents.size();
+    }
+
+    // Drop a file from all results without touching its postings
+    void markDocumentDeleted(DocId fileId)
+    {
+        unsigned long long sequence = 0;
+        {
+            lock_guard<shared_mutex> lock(indexMutex);
+            deletedDocuments.add(fileId);
+            deletedDocuments.runOptimize();
+            indexGeneration++;
+            if (writeAheadLog)
+                sequence = writeAheadLog->append(WriteAheadLog::REMOVE_DOCUMENT, documents.path(fileId));
+        }
+        if (sequence && !writeAheadLog->commit(sequence))
+            cerr << "Warning: could not write to the write-ahead log" << endl;
+    }
+
+    // Records in the attached write-ahead log since the last checkpoint
+    long long loggedRecords()
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return writeAheadLog ? writeAheadLog->recordCount() : 0;
+    }
+
+    // Log document additions and removals from now on (nullptr stops logging)
+    void attachWriteAheadLog(WriteAheadLog *log)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        writeAheadLog = log;
+    }
+
+    // Persist the whole index to path and empty the attached log, which the
+    // snapshot now covers. Files still being indexed are saved by path
+    // only and indexed again from scratch on recovery.
+    bool checkpoint(const char *path)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        if (!saveSnapshotLocked(path))
+            return false;
+        return !writeAheadLog || writeAheadLog->reset();
+    }
+
+    // Load a snapshot written by checkpoint into this (empty) index.
+    // Returns the number of documents restored, or -1 if the file is
+    // missing, truncated, fails its checksum or was built over another
+    // alphabet. trigramsRestored tells whether the snapshot carried a
+    // trigram index.
+    long long loadSnapshot(const char *path, bool &trigramsRestored)
+    {
+        ifstream in(path, ios::binary);
+        if (!in)
+            return -1;
+        vector<uint8_t> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        if (data.size() < 8 + 2 * sizeof(uint32_t))
+            return -1;
+        // Version 1 snapshots predate alphabets and hold lowercase ASCII keys
+        bool versionOne = memcmp(data.data(), "IDXSNAP1", 8) == 0;
+        if (!versionOne && memcmp(data.data(), "IDXSNAP2", 8) != 0)
+            return -1;
+        uint32_t crc;
+        memcpy(&crc, data.data() + data.size() - sizeof(crc), sizeof(crc));
+        if (crc32(data.data(), data.size() - sizeof(crc)) != crc)
+            return -1;
+
+        const uint8_t *position = data.data() + 8;
+        const uint8_t *end = data.data() + data.size() - sizeof(crc);
+        auto read = [&](void *value, size_t bytes)
+        {
+            if (static_cast<size_t>(end - position) < bytes)
+                return false;
+            memcpy(value, position, bytes);
+            position += bytes;
+            return true;
+        };
+        auto readString = [&](string &text)
+        {
+            uint16_t length;
+            if (!read(&length, sizeof(length)) || end - position < length)
+                return false;
+            text.assign(reinterpret_cast<const char *>(position), length);
+            position += length;
+            return true;
+        };
+
+        string text;
+        if (versionOne)
+            text = LowercaseAscii::NAME;
+        else if (!readString(text))
+            return -1;
+        if (text != Alphabet::NAME)
+            return -1;
+
+        lock_guard<shared_mutex> lock(indexMutex);
+        uint32_t documentCount, termCount;
+        if (!read(&documentCount, sizeof(documentCount)))
+            return -1;
+        for (uint32_t i = 0; i < documentCount; i++)
+        {
+            uint8_t status;
+            if (!readString(text) || !read(&status, sizeof(status)))
+                return -1;
+            // A path appears again for each time its file was replaced
+            DocId id = addFileLocked(text.c_str(), true);
+            if (status == 1)
+                deletedDocuments.add(id);
+            if (status != 2)
+                pendingDocuments.erase(id);
+        }
+        deletedDocuments.runOptimize();
+
+        vector<FileInfo> postings;
+        if (!read(&termCount, sizeof(termCount)))
+            return -1;
+        for (uint32_t i = 0; i < termCount; i++)
+        {
+            uint32_t recordBytes;
+            if (!readString(text) || !read(&recordBytes, sizeof(recordBytes)) ||
+                static_cast<size_t>(end - position) < recordBytes)
+                return -1;
+            CompressedPostings::Reader(position, position + recordBytes).decode(postings);
+            position += recordBytes;
+            for (const FileInfo &info : postings)
+                insertPostingsLocked(text.c_str(), info.fileId, info.frequency, info.positions, info.positionCount);
+        }
+        // Documents saved mid-indexing stay pending, filters unsealed, until
+        // recoverIndex indexes them again
+        for (uint32_t id = 0; id < documentCount; id++)
+        {
+            if (!pendingDocuments.count(id))
+                documentFilters[id].seal();
+        }
+
+        uint8_t hasTrigrams = 0;
+        trigramsRestored = false;
+        if (!read(&hasTrigrams, sizeof(hasTrigrams)))
+            return -1;
+        if (hasTrigrams)
+        {
+            uint32_t gramCount, gram, docCount;
+            if (!read(&gramCount, sizeof(gramCount)))
+                return -1;
+            for (uint32_t i = 0; i < gramCount; i++)
+            {
+                if (!read(&gram, sizeof(gram)) || !read(&docCount, sizeof(docCount)) ||
+                    static_cast<size_t>(end - position) / sizeof(DocId) < docCount)
+                    return -1;
+                vector<DocId> docs(docCount);
+                read(docs.data(), docCount * sizeof(DocId));
+                if (trigramIndex.enabled())
+                    trigramIndex.setPostings(gram, move(docs));
+            }
+            trigramsRestored = trigramIndex.enabled();
+        }
+        return documentCount;
+    }
+
+    bool isDocumentDeleted(DocId fileId)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return deletedDocuments.contains(fileId);
+    }
+
+    // Registered but not yet passed to finishDocument
+    bool isDocumentPending(DocId fileId)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return pendingDocuments.count(fileId) > 0;
+    }
+
+    DocSet getDeletedDocuments()
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return deletedDocuments;
+    }
+
+    // The path stays valid after the lock is released: the table's deque
+    // never moves a path once added
+    const char *getFilename(DocId fileId)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return documents.path(fileId);
+    }
+
+    // The term a word stems to, its occurrences in live documents and one
+    // hit per document with the term's frequency and position span
+    bool getWordDetails(const char *word, SearchResults &details, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return getWordDetailsLocked(word, details, budget);
+    }
+
+    // Compute and cache getWordDetails for a hot word. The cache only holds
+    // warmed words, so its size is bounded by the number warmed.
+    bool warmWord(const char *word)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        unsigned long long generation = indexGeneration;
+        detailCache.erase(word);
+        SearchResults details;
+        if (!getWordDetailsLocked(word, details))
+        {
+            return false;
+        }
+
+        CachedDetails &entry = detailCache[word];
+        entry.generation = generation;
+        entry.details = move(details);
+        return true;
+    }
+
+    // Count the terms of a logged query towards autocomplete ranking
+    void recordQueryTerms(const char *query, int weight = 1)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        istringstream words(query);
+        string word;
+        while (words >> word)
+        {
+            char wordCopy[MAX_WORD_LENGTH];
+            char key[MAX_WORD_LENGTH];
+            snprintf(wordCopy, MAX_WORD_LENGTH, "%s", word.c_str());
+            stem(wordCopy);
+            normalizeKey(wordCopy, key);
+            if (key[0] != '\0')
+            {
+                termPopularity[key] += weight;
+            }
+        }
+    }
+
+    void clearQueryStats()
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        termPopularity.clear();
+        detailCache.clear();
+    }
+
+    // Partial search functionality. Every query below takes an optional
+    // budget; once it runs out the walk stops and returns what it has.
+    // Pass the last term of one page as after to get the next page.
+    bool partialSearch(const char *word, char results[MAX_RESULTS][MAX_WORD_LENGTH], int &resultCount,
+                       QueryBudget &budget = QueryBudget::unlimited(), const char *after = nullptr)
+    {
+        resultCount = 0;
+        shared_lock<shared_mutex> lock(indexMutex);
+        TrieCursor cursor = prefixCursorLocked(word, after);
+        collectWords(cursor, results, resultCount, MAX_RESULTS, budget);
+        return resultCount > 0;
+    }
+
+    // Cursor over the terms starting with prefix, in key order. With after
+    // set it starts at the first such term greater than after. Advance it
+    // with nextTerm, which holds the lock for each step.
+    TrieCursor prefixCursor(const char *prefix, const char *after = nullptr)
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return prefixCursorLocked(prefix, after);
+    }
+
+    // Next term of a cursor from prefixCursor. Terms indexed between calls
+    // show up only if they sort after the cursor's position.
+    bool nextTerm(TrieCursor &cursor, string_view &term, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return nextLiveTerm(cursor, term, budget);
+    }
+
+    // Autocomplete functionality
+    bool autocomplete(const char *prefix, char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH], int &suggestionCount,
+                      QueryBudget &budget = QueryBudget::unlimited())
+    {
+        suggestionCount = 0;
+
+        shared_lock<shared_mutex> lock(indexMutex);
+        TrieNode *current = descend(prefix);
+        if (!current)
+            return false;
+
+        // Terms searched before come first, most searched first
+        char key[MAX_WORD_LENGTH];
+        normalizeKey(prefix, key);
+        size_t keyLength = strlen(key);
+        vector<pair<int, const string *>> popular;
+        for (const auto &entry : termPopularity)
+        {
+            TrieNode *node = entry.first.compare(0, keyLength, key) == 0 ? findNodeLocked(entry.first.c_str()) : nullptr;
+            if (node && hasLiveDocuments(node, budget))
+            {
+                popular.push_back({entry.second, &entry.first});
+            }
+        }
+        sort(popular.begin(), popular.end(), [](const pair<int, const string *> &a, const pair<int, const string *> &b)
+             { return a.first != b.first ? a.first > b.first : *a.second < *b.second; });
+        for (size_t i = 0; i < popular.size() && suggestionCount < MAX_SUGGESTIONS; i++)
+        {
+            snprintf(suggestions[suggestionCount++], MAX_WORD_LENGTH, "%s", popular[i].second->c_str());
+        }
+        if (popular.empty())
+        {
+            TrieCursor cursor(current);
+            collectWords(cursor, suggestions, suggestionCount, MAX_SUGGESTIONS, budget);
+            return suggestionCount > 0;
+        }
+
+        // Then the rest in trie order
+        char others[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+        int otherCount = 0;
+        TrieCursor cursor(current);
+        collectWords(cursor, others, otherCount, MAX_SUGGESTIONS, budget);
+        for (int i = 0; i < otherCount && suggestionCount < MAX_SUGGESTIONS; i++)
+        {
+            if (!termPopularity.count(others[i]))
+            {
+                strcpy(suggestions[suggestionCount++], others[i]);
+            }
+        }
+        return suggestionCount > 0;
+    }
+
+    // Boolean search: words are ANDed, "OR" separates alternatives and a
+    // leading '-' excludes a word, e.g. "search engine OR index -draft"
+    // One hit per matching document, in doc id order.
+    bool advancedSearch(const char *query, SearchResults &results, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        results.clear();
+
+        // Split the query into words
+        char queryCopy[MAX_WORD_LENGTH];
+        strncpy(queryCopy, query, MAX_WORD_LENGTH);
+
+        char *words[MAX_SUGGESTIONS];
+        int wordCount = 0;
+
+        char *token = strtok(queryCopy, " ");
+        while (token != NULL && wordCount < MAX_SUGGESTIONS)
+        {
+            words[wordCount++] = token;
+            token = strtok(NULL, " ");
+        }
+
+        if (wordCount == 0)
+            return false;
+
+        shared_lock<shared_mutex> lock(indexMutex);
+        DocSet matches, excluded;
+        vector<TrieNode *> required;
+        bool groupHasTerms = false;
+        bool groupPossible = true; // Cleared when a required word is not indexed
+        auto closeGroup = [&]()
+        {
+            // A group cut short by the budget is dropped rather than guessed at
+            if (groupHasTerms && groupPossible && !budget.truncated())
+                matches = DocSet::unite(matches, evaluateGroup(required, excluded));
+            required.clear();
+            excluded = DocSet();
+            groupHasTerms = false;
+            groupPossible = true;
+        };
+
+        for (int w = 0; w < wordCount && !budget.truncated(); w++)
+        {
+            if (strcmp(words[w], "OR") == 0)
+            {
+                closeGroup();
+                continue;
+            }
+
+            bool negated = words[w][0] == '-';
+            char *term = words[w] + negated;
+            char key[MAX_WORD_LENGTH];
+            stem(term);
+            normalizeKey(term, key);
+            if (key[0] == '\0')
+                continue;
+            groupHasTerms = true;
+
+            // The term filter rules most missing words out without a descent
+            TrieNode *node = mayContainTermLocked(key) ? descend(key) : nullptr;
+            if (node && !node->isEndOfWord)
+                node = nullptr;
+            // Charge the postings this term will make us read
+            if (node && !budget.spend(1 + node->fileInfoCount))
+                break;
+
+            if (negated)
+            {
+                if (node)
+                    excluded = DocSet::unite(excluded, *termDocSet(node));
+            }
+            else if (!node)
+            {
+                groupPossible = false;
+            }
+            else
+            {
+                required.push_back(node);
+            }
+        }
+        closeGroup();
+
+        vector<uint32_t> docs;
+        DocSet::subtract(matches, deletedDocuments).toVector(docs);
+        for (size_t i = 0; i < docs.size() && i < (size_t)MAX_RESULTS; i++)
+        {
+            results.add(docs[i]);
+        }
+
+        return !results.hits.empty();
+    }
+
+    // Levenshtein distance with a scalar two-row DP. Kept as the reference
+    // the bit-parallel kernel is benchmarked against.
+    int editDistanceScalar(const char *s1, const char *s2)
+    {
+        int len1 = strlen(s1);
+        int len2 = strlen(s2);
+
+        // Create a 2D array to store distances
+        // We only need two rows, the current and previous
+        int dp[2][MAX_WORD_LENGTH + 1];
+
+        // Initialize the first row
+        for (int j = 0; j <= len2; j++)
+        {
+            dp[0][j] = j;
+        }
+
+        // Fill the dp table
+        for (int i = 1; i <= len1; i++)
+        {
+            for (int j = 0; j <= len2; j++)
+            {
+                if (j == 0)
+                {
+                    dp[i % 2][j] = i;
+                }
+                else if (s1[i - 1] == s2[j - 1])
+                {
+                    dp[i % 2][j] = dp[(i - 1) % 2][j - 1];
+                }
+                else
+                {
+                    dp[i % 2][j] = 1 + min(
+                                           dp[(i - 1) % 2][j], // Delete
+                                           min(
+                                               dp[i % 2][j - 1],      // Insert
+                                               dp[(i - 1) % 2][j - 1] // Replace
+                                               ));
+                }
+            }
+        }
+
+        return dp[len1 % 2][len2];
+    }
+
+    // Levenshtein distance using the bit-parallel kernel
+    int editDistance(const char *s1, const char *s2)
+    {
+        return MyersMatcher(s1).distance(s2);
+    }
+
+    // Distances from one query to many candidates, sharing the query's setup
+    void editDistanceBatch(const char *query, const vector<string> &candidates, vector<int> &distances)
+    {
+        MyersMatcher(query).distances(candidates, distances);
+    }
+
+    // Wildcard search over indexed terms: '?' matches one letter, '*' any
+    // run of letters. One hit per term and live document, in term order.
+    bool wildcardSearch(const char *pattern, SearchResults &results, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        results.clear();
+
+        // Lowercase and collapse runs of '*'
+        char normalized[MAX_WORD_LENGTH];
+        int length = 0;
+        for (int i = 0; pattern[i] != '\0' && length < MAX_WORD_LENGTH - 1; i++)
+        {
+            char ch = pattern[i];
+            if (ch == '*' && length > 0 && normalized[length - 1] == '*')
+                continue;
+            if (ch != '?' && ch != '*')
+            {
+                ch = Alphabet::keyChar(ch);
+                if (ch == '\0')
+                    return false;
+            }
+            normalized[length++] = ch;
+        }
+        normalized[length] = '\0';
+
+        PatternStates start;
+        start[0] = true;
+        closeOverStars(normalized, length, start);
+
+        shared_lock<shared_mutex> lock(indexMutex);
+        vector<TrieNode *> matches;
+        wildcardWalk(root, normalized, length, start, matches, MAX_RESULTS, budget);
+
+        for (TrieNode *node : matches)
+            addTermHits(node, results, budget);
+        return !results.hits.empty();
+    }
+
+    // Terms ending with suffix, as hits like wildcardSearch's
+    bool suffixSearch(const char *suffix, SearchResults &results, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        results.clear();
+        char key[MAX_WORD_LENGTH];
+        normalizeKey(suffix, key);
+        if (key[0] == '\0')
+            return false;
+
+        shared_lock<shared_mutex> lock(indexMutex);
+        vector<string> terms;
+        affixIndex.suffixMatches(key, MAX_RESULTS, terms, budget);
+        return addTermListHits(terms, results, budget);
+    }
+
+    // Terms containing infix anywhere, as hits like wildcardSearch's
+    bool infixSearch(const char *infix, SearchResults &results, QueryBudget &budget = QueryBudget::unlimited())
+    {
+        results.clear();
+        char key[MAX_WORD_LENGTH];
+        normalizeKey(infix, key);
+        if (key[0] == '\0')
+            return false;
+
+        shared_lock<shared_mutex> lock(indexMutex);
+        if (affixIndex.needsRebuild())
+        {
+            // Re-sort the suffix array if terms were added since the last
+            // query. Terms added between the two locks are missed until the
+            // next rebuild; the array stays valid for the terms it covers.
+            lock.unlock();
+            refreshAffixIndex();
+            lock.lock();
+        }
+        vector<string> terms;
+        affixIndex.infixMatches(key, MAX_RESULTS, terms, budget);
+        return addTermListHits(terms, results, budget);
+    }
+
+    // Documents whose text contains the given substring (case-insensitive),
+    // one hit each. With the trigram index only candidate documents are
+    // read to verify.
+    bool substringSearch(const char *text, SearchResults &results, int *documentsChecked = nullptr,
+                         QueryBudget &budget = QueryBudget::unlimited())
+    {
+        results.clear();
+        string lowerText = text;
+        transform(lowerText.begin(), lowerText.end(), lowerText.begin(), ::tolower);
+        if (lowerText.empty())
+            return false;
+
+        vector<DocId> candidates;
+        vector<pair<DocId, string>> paths; // Live candidates, so files are read without the lock
+        {
+            shared_lock<shared_mutex> lock(indexMutex);
+            bool filtered = trigramIndex.enabled() && trigramIndex.candidates(lowerText.c_str(), candidates);
+            if (!filtered)
+            {
+                // Too short to filter on (or no index): every document is a candidate
+                for (size_t i = 0; i < documents.size(); i++)
+                    candidates.push_back(i);
+            }
+            for (DocId fileId : candidates)
+            {
+                if (!deletedDocuments.contains(fileId))
+                    paths.push_back({fileId, documents.path(fileId)});
+            }
+        }
+
+        if (documentsChecked)
+            *documentsChecked = candidates.size();
+        for (const auto &path : paths)
+        {
+            if (results.hits.size() >= (size_t)MAX_RESULTS)
+                break;
+            // Reading a file costs far more than a trie step
+            if (!budget.spend(SUBSTRING_FILE_COST))
+                break;
+            if (fileContainsText(path.second.c_str(), lowerText))
+                results.add(path.first);
+        }
+        return !results.hits.empty();
+    }
+
+    bool trigramIndexEnabled()
+    {
+        shared_lock<shared_mutex> lock(indexMutex);
+        return trigramIndex.enabled();
+    }
+
+    void enableTrigramIndex()
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        trigramIndex.enable();
+    }
+
+    void addDocumentTrigrams(DocId fileId, const TrigramCollector &collector)
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        trigramIndex.addDocument(fileId, collector);
+    }
+
+    // Bring the suffix array up to date, e.g. once indexing finishes
+    void refreshAffixIndex()
+    {
+        lock_guard<shared_mutex> lock(indexMutex);
+        if (affixIndex.needsRebuild())
+            affixIndex.rebuildSuffixArray();
+    }
+
+    // Find words similar to the misspelled word
+    bool spellCheck(const char *word, char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH], int &suggestionCount,
+                    QueryBudget &budget = QueryBudget::unlimited())
+    {
+        suggestionCount = 0;
+        shared_lock<shared_mutex> lock(indexMutex);
+
+        // With the deletion index a few hash lookups give the candidates
+        if (deletionIndex.enabled() && deletionIndex.getMaxDistance() >= MAX_EDIT_DISTANCE)
+        {
+            if (!budget.spend())
+                return false;
+            vector<pair<int, string>> matches;
+            deletionIndex.lookup(word, MAX_EDIT_DISTANCE, matches);
+            budget.spend(matches.size());
+            for (size_t i = 0; i < matches.size() && suggestionCount < MAX_SUGGESTIONS; i++)
+            {
+                strncpy(suggestions[suggestionCount++], matches[i].second.c_str(), MAX_WORD_LENGTH);
+            }
+            return suggestionCount > 0;
+        }
+
+        // Score every word in the dictionary against the query, sharing the
+        // query's setup. Collecting is charged per node and scoring per word
+        // before it runs, so a budget cut keeps only the words scored so far.
+        vector<string> allWords;
+        collectVocabulary(root, allWords, budget);
+        MyersMatcher matcher(word);
+        vector<int> distances;
+        for (const string &candidate : allWords)
+        {
+            if (!budget.spend())
+                break;
+            distances.push_back(matcher.distance(candidate.c_str()));
+        }
+        allWords.resize(distances.size());
+
+        vector<pair<int, size_t>> matches;
+        for (size_t i = 0; i < allWords.size(); i++)
+        {
+            if (distances[i] <= MAX_EDIT_DISTANCE)
+            {
+                matches.push_back({distances[i], i});
+            }
+        }
+
+        // Closest first; ties stay in alphabetical order
+        stable_sort(matches.begin(), matches.end(), [](const pair<int, size_t> &a, const pair<int, size_t> &b)
+                    { return a.first < b.first; });
+
+        // Copy suggestions
+        for (size_t i = 0; i < matches.size() && suggestionCount < MAX_SUGGESTIONS; i++)
+        {
+            strncpy(suggestions[suggestionCount++], allWords[matches[i].second].c_str(), MAX_WORD_LENGTH);
+        }
+
+        return suggestionCount > 0;
+    }
+
+    // Word proximity search: one hit per document where the words occur
+    // within maxDistance, with the positions of the first close pair as
+    // its span and closer pairs scoring higher
+    bool proximitySearch(const char *word1, const char *word2, int maxDistance, SearchResults &results,
+                         QueryBudget &budget = QueryBudget::unlimited())
+    {
+        results.clear();
+
+        char stemmed1[MAX_WORD_LENGTH];
+        char stemmed2[MAX_WORD_LENGTH];
+
+        strncpy(stemmed1, word1, MAX_WORD_LENGTH);
+        strncpy(stemmed2, word2, MAX_WORD_LENGTH);
+
+        stem(stemmed1);
+        stem(stemmed2);
+        normalizeKey(stemmed1, stemmed1);
+        normalizeKey(stemmed2, stemmed2);
+
+        // Look each word up once, rather than once per file
+        shared_lock<shared_mutex> lock(indexMutex);
+        TrieNode *node1 = findNodeLocked(stemmed1);
+        TrieNode *node2 = findNodeLocked(stemmed2);
+        if (!node1 || !node2)
+            return false;
+
+        // Read the rarer word's postings first and keep the live documents
+        // whose filters admit the other word; the other word's postings are
+        // only read if some document survives
+        bool firstRarer = node1->termFrequency <= node2->termFrequency;
+        TrieNode *rare = firstRarer ? node1 : node2;
+        const char *otherKey = firstRarer ? stemmed2 : stemmed1;
+        vector<FileInfo> scratch1, scratch2;
+        const vector<FileInfo> &rarePostings = postingsOfLocked(rare, firstRarer ? scratch1 : scratch2);
+        if (!budget.spend(rarePostings.size()))
+            return false;
+        vector<DocId> candidates;
+        for (const FileInfo &info : rarePostings)
+        {
+            if (!deletedDocuments.contains(info.fileId) && documentMayContainLocked(info.fileId, otherKey))
+                candidates.push_back(info.fileId);
+        }
+        if (candidates.empty())
+            return false;
+        sort(candidates.begin(), candidates.end());
+
+        const vector<FileInfo> &postings1 = firstRarer ? rarePostings : postingsOfLocked(node1, scratch1);
+        const vector<FileInfo> &postings2 = firstRarer ? postingsOfLocked(node2, scratch2) : rarePostings;
+
+        // Walk the documents containing both words in id order
+        vector<size_t> order1(postings1.size()), order2(postings2.size());
+        for (size_t i = 0; i < order1.size(); i++)
+            order1[i] = i;
+        for (size_t i = 0; i < order2.size(); i++)
+            order2[i] = i;
+        sort(order1.begin(), order1.end(), [&](size_t a, size_t b)
+             { return postings1[a].fileId < postings1[b].fileId; });
+        sort(order2.begin(), order2.end(), [&](size_t a, size_t b)
+             { return postings2[a].fileId < postings2[b].fileId; });
+
+        size_t next1 = 0, next2 = 0;
+        while (next1 < order1.size() && next2 < order2.size() && results.hits.size() < (size_t)MAX_RESULTS)
+        {
+            const FileInfo &info1 = postings1[order1[next1]];
+            const FileInfo &info2 = postings2[order2[next2]];
+            if (info1.fileId != info2.fileId)
+            {
+                (info1.fileId < info2.fileId ? next1 : next2)++;
+                continue;
+            }
+            next1++;
+            next2++;
+            DocId fileId = info1.fileId;
+            if (!budget.spend(1 + info1.positionCount + info2.positionCount))
+                break;
+
+            // Deleted files and those the filters ruled out were left out of the candidates
+            if (!binary_search(candidates.begin(), candidates.end(), fileId))
+                continue;
+
+            const int *positions1 = info1.positions;
+            const int *positions2 = info2.positions;
+            int pos1Count = info1.positionCount;
+            int pos2Count = info2.positionCount;
+
+            // Check if words appear close to each other
+            bool foundProximity = false;
+            for (int i = 0; i < pos1Count; i++)
+            {
+                for (int j = 0; j < pos2Count; j++)
+                {
+                    int distance = abs(positions1[i] - positions2[j]);
+                    if (distance <= maxDistance)
+                    {
+                        results.add(fileId, nullptr, 0, min(positions1[i], positions2[j]), max(positions1[i], positions2[j]),
+                                    1.0 / (1 + distance));
+                        foundProximity = true;
+                        break;
+                    }
+                }
+                if (foundProximity)
+                    break;
+            }
+        }
+
+        return !results.hits.empty();
+    }
+
+    // Export search results to file
+    bool exportResults(const char *filename, const vector<string> &results)
+    {
+        // Ensure the file has .txt extension
+        string txtFilename = filename;
+        if (txtFilename.length() < 4 || txtFilename.substr(txtFilename.length() - 4) != ".txt")
+        {
+            txtFilename += ".txt";
+        }
+
+        FILE *file = fopen(txtFilename.c_str(), "w");
+        if (!file)
+        {
+            return false;
+        }
+
+        // Get the current date and time
+        time_t now = time(0);
+        struct tm *timeinfo = localtime(&now);
+        char timeStr[80];
+        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", timeinfo);
+
+        fprintf(file, "Search Results - %s\n", timeStr);
+        fprintf(file, "--------------------------------\n");
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            fprintf(file, "%zu. %s\n", i + 1, results[i].c_str());
+        }
+
+        fprintf(file, "--------------------------------\n");
+        fprintf(file, "Total Results: %zu\n", results.size());
+
+        fclose(file);
+        return true;
+    }
+
+    // Export search results to CSV
+    bool exportToCSV(const char *filename, const vector<string> &results)
+    {
+        // Ensure the file has .csv extension
+        string csvFilename = filename;
+        if (csvFilename.length() < 4 || csvFilename.substr(csvFilename.length() - 4) != ".csv")
+        {
+            csvFilename += ".csv";
+        }
+
+        FILE *file = fopen(csvFilename.c_str(), "w");
+        if (!file)
+        {
+            return false;
+        }
+
+        // Get the current date and time
+        time_t now = time(0);
+        struct tm *timeinfo = localtime(&now);
+        char timeStr[80];
+        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", timeinfo);
+
+        // Write CSV header
+        fprintf(file, "Index,Result,Timestamp\n");
+
+        // Write data rows
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            // Escape any commas in the result
+            string escapedResult;
+            for (char ch : results[i])
+            {
+                if (ch == ',')
+                {
+                    escapedResult += "\",\"";
+                }
+                else
+                {
+                    escapedResult += ch;
+                }
+            }
+
+            fprintf(file, "%zu,%s,%s\n", i + 1, escapedResult.c_str(), timeStr);
+        }
+
+        fclose(file);
+        return true;
+    }
+
+    // Export word details to PDF-like text file (simplified PDF representation)
+    bool exportToPDF(const char *filename, const vector<string> &results)
+    {
+        // Ensure the file has .pdf extension
+        string pdfFilename = filename;
+        if (pdfFilename.length() < 4 || pdfFilename.substr(pdfFilename.length() - 4) != ".pdf")
+        {
+            pdfFilename += ".pdf";
+        }
+
+        FILE *file = fopen(pdfFilename.c_str(), "wb"); // Use binary mode for better compatibility
+        if (!file)
+        {
+            return false;
+        }
+
+        // Get the current date and time
+        time_t now = time(0);
+        struct tm *timeinfo = localtime(&now);
+        char timeStr[80];
+        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", timeinfo);
+
+        // Basic PDF structure (simplified)
+        fprintf(file, "%%PDF-1.4\n");
+
+        // Object 1: Catalog
+        long obj1Pos = ftell(file);
+        fprintf(file, "1 0 obj\n");
+        fprintf(file, "<<\n");
+        fprintf(file, "/Type /Catalog\n");
+        fprintf(file, "/Pages 2 0 R\n");
+        fprintf(file, ">>\n");
+        fprintf(file, "endobj\n");
+
+        // Object 2: Pages
+        long obj2Pos = ftell(file);
+        fprintf(file, "2 0 obj\n");
+        fprintf(file, "<<\n");
+        fprintf(file, "/Type /Pages\n");
+        fprintf(file, "/Kids [3 0 R]\n");
+        fprintf(file, "/Count 1\n");
+        fprintf(file, ">>\n");
+        fprintf(file, "endobj\n");
+
+        // Object 3: Page
+        long obj3Pos = ftell(file);
+        fprintf(file, "3 0 obj\n");
+        fprintf(file, "<<\n");
+        fprintf(file, "/Type /Page\n");
+        fprintf(file, "/Parent 2 0 R\n");
+        fprintf(file, "/Resources <<\n");
+        fprintf(file, "  /Font <<\n");
+        fprintf(file, "    /F1 4 0 R\n");
+        fprintf(file, "  >>\n");
+        fprintf(file, ">>\n");
+        fprintf(file, "/MediaBox [0 0 612 792]\n");
+        fprintf(file, "/Contents 5 0 R\n");
+        fprintf(file, ">>\n");
+        fprintf(file, "endobj\n");
+
+        // Object 4: Font
+        long obj4Pos = ftell(file);
+        fprintf(file, "4 0 obj\n");
+        fprintf(file, "<<\n");
+        fprintf(file, "/Type /Font\n");
+        fprintf(file, "/Subtype /Type1\n");
+        fprintf(file, "/BaseFont /Helvetica\n");
+        fprintf(file, "/Encoding /WinAnsiEncoding\n");
+        fprintf(file, ">>\n");
+        fprintf(file, "endobj\n");
+
+        // Build content string
+        string content = "BT\n";
+        content += "/F1 14 Tf\n";
+        content += "50 750 Td\n";
+        content += "(Mini Search Engine - Export Results) Tj\n";
+        content += "0 -25 Td\n";
+        content += "/F1 10 Tf\n";
+        content += "(Generated on: " + string(timeStr) + ") Tj\n";
+        content += "0 -30 Td\n";
+
+        // Set up a table-like format for results
+        int yPos = 680; // Starting Y position for results
+
+        for (size_t i = 0; i < results.size() && i < (size_t)MAX_RESULTS; i++)
+        {
+            // Check if we need to start a new page (simplified - not implementing multi-page)
+            if (yPos < 100)
+            {
+                break;
+            }
+
+            // Sanitize the content for PDF (escape special characters)
+            string line = "";
+            line += "50 " + to_string(yPos) + " Td\n";
+            line += "(";
+
+            // Create a formatted row
+            string rowText = to_string(i + 1) + ". ";
+            for (char ch : results[i])
+            {
+                if (ch == '(' || ch == ')' || ch == '\\')
+                {
+                    rowText += "\\";
+                }
+                rowText += ch;
+            }
+            line += rowText;
+            line += ") Tj\n";
+
+            content += line;
+            yPos -= 20; // Move down for next line
+        }
+
+        // Add total results count at the bottom
+        content += "50 50 Td\n";
+        content += "(Total Results: " + to_string(results.size()) + ") Tj\n";
+        content += "ET";
+
+        // Object 5: Content Stream
+        long obj5Pos = ftell(file);
+        fprintf(file, "5 0 obj\n");
+        fprintf(file, "<<\n");
+        fprintf(file, "/Length %zu\n", content.length());
+        fprintf(file, ">>\n");
+        fprintf(file, "stream\n");
+        fprintf(file, "%s\n", content.c_str());
+        fprintf(file, "endstream\n");
+        fprintf(file, "endobj\n");
+
+        // Cross-reference table
+        long xref_pos = ftell(file);
+        fprintf(file, "xref\n");
+        fprintf(file, "0 6\n");
+        fprintf(file, "0000000000 65535 f\n");
+        fprintf(file, "%010ld 00000 n\n", obj1Pos);
+        fprintf(file, "%010ld 00000 n\n", obj2Pos);
+        fprintf(file, "%010ld 00000 n\n", obj3Pos);
+        fprintf(file, "%010ld 00000 n\n", obj4Pos);
+        fprintf(file, "%010ld 00000 n\n", obj5Pos);
+
+        // Trailer
+        fprintf(file, "trailer\n");
+        fprintf(file, "<<\n");
+        fprintf(file, "/Size 6\n");
+        fprintf(file, "/Root 1 0 R\n");
+        fprintf(file, ">>\n");
+        fprintf(file, "startxref\n");
+        fprintf(file, "%ld\n", xref_pos);
+        fprintf(file, "%%%%EOF\n");
+
+        fclose(file);
+        return true;
+    }
+};
+
+// File processing functions
+
+// Clean, stop-word filter and stem one raw token into cleaned.
+// Returns false for stop words, which do not advance the word position.
+bool normalizeToken(const char *raw, char *cleaned, Trie &trie)
+{
+    // Keep the characters the trie's alphabet indexes, case folded
+    int j = 0;
+    for (int i = 0; raw[i] && j < MAX_WORD_LENGTH - 1; i++)
+    {
+        char ch = TRIE_ALPHABET::keyChar(raw[i]);
+        if (ch != '\0')
+        {
+            cleaned[j++] = ch;
+        }
+    }
+    cleaned[j] = '\0';
+
+    // Stop word removal
+    if (trie.isStopWord(cleaned))
+    {
+        return false;
+    }
+
+    // Stemming
+    trie.stem(cleaned);
+    return true;
+}
+
+void processFile(const string &filename, Trie &trie)
+{
+    FILE *file = fopen(filename.c_str(), "r");
+    if (!file)
+    {
+        cerr << "Error opening file: " << filename << endl;
+        return;
+    }
+
+    // Add file to file list and get file ID
+    DocId fileId = trie.addFile(filename.c_str());
+
+    bool collectTrigrams = trie.trigramIndexEnabled();
+    TrigramCollector trigrams;
+
+    char word[MAX_WORD_LENGTH];
+    int position = 1;
+    while (fscanf(file, "%99s", word) == 1)
+    {
+        if (collectTrigrams)
+        {
+            trigrams.addToken(word);
+        }
+
+        char cleanedWord[MAX_WORD_LENGTH];
+        if (!normalizeToken(word, cleanedWord, trie))
+        {
+            continue;
+        }
+
+        if (strlen(cleanedWord) > 0)
+        {
+            trie.insert(cleanedWord, fileId, position);
+        }
+
+        position++;
+    }
+
+    fclose(file);
+
+    if (collectTrigrams)
+    {
+        trie.addDocumentTrigrams(fileId, trigrams);
+    }
+    trie.finishDocument(fileId);
+}
+
+// Splits a byte stream into whitespace separated tokens of at most
+// MAX_WORD_LENGTH - 1 bytes, matching what fscanf("%99s") would return
+struct TokenSplitter
+{
+    char word[MAX_WORD_LENGTH];
+    int wordLength = 0;
+
+    template <typename Emit>
+    void feed(const char *data, size_t size, Emit &&emit)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            if (isspace(static_cast<unsigned char>(data[i])))
+            {
+                if (wordLength > 0)
+                {
+                    finish(emit);
+                }
+            }
+            else
+            {
+                word[wordLength++] = data[i];
+                if (wordLength == MAX_WORD_LENGTH - 1)
+                {
+                    finish(emit);
+                }
+            }
+        }
+    }
+
+    // Emit any partially read token, e.g. at end of input
+    template <typename Emit>
+    void finish(Emit &&emit)
+    {
+        if (wordLength > 0)
+        {
+            word[wordLength] = '\0';
+            wordLength = 0;
+            emit(word);
+        }
+    }
+};
+
+// Postings for one word gathered by a chunk thread, positions relative to the chunk
+struct ChunkPostings
+{
+    int frequency = 0;
+    vector<int> positions;
+};
+
+struct ChunkResult
+{
+    unordered_map<string, ChunkPostings> postings;
+    int positionCount = 0; // Positions consumed by this chunk, used to offset later chunks
+    TrigramCollector trigrams;
+};
+
+// Tokenize bytes [begin, end) of a file exactly as fscanf("%99s") would
+void indexChunk(const string &filename, long long begin, long long end, Trie &trie, ChunkResult &result)
+{
+    ifstream in(filename, ios::binary);
+    if (!in)
+    {
+        return;
+    }
+    in.seekg(begin);
+
+    vector<char> buffer(CHUNK_READ_BUFFER_SIZE);
+    TokenSplitter splitter;
+    long long remaining = end - begin;
+
+    bool collectTrigrams = trie.trigramIndexEnabled();
+    auto addWord = [&](const char *word)
+    {
+        if (collectTrigrams)
+        {
+            result.trigrams.addToken(word);
+        }
+
+        char cleanedWord[MAX_WORD_LENGTH];
+        if (!normalizeToken(word, cleanedWord, trie))
+        {
+            return;
+        }
+        if (cleanedWord[0] != '\0')
+        {
+            ChunkPostings &postings = result.postings[cleanedWord];
+            postings.frequency++;
+            if (postings.positions.size() < MAX_WORD_LENGTH)
+            {
+                postings.positions.push_back(result.positionCount);
+            }
+        }
+        result.positionCount++;
+    };
+
+    while (remaining > 0)
+    {
+        in.read(buffer.data(), min<long long>(remaining, buffer.size()));
+        streamsize got = in.gcount();
+        if (got <= 0)
+        {
+            break;
+        }
+        remaining -= got;
+        splitter.feed(buffer.data(), got, addWord);
+    }
+    splitter.finish(addWord);
+}
+
+// Index a single large file with several threads, each owning a byte range
+// that starts and ends on whitespace so no token is split between chunks
+void processFileChunked(const string &filename, Trie &trie, unsigned int numThreads)
+{
+    error_code ec;
+    long long fileSize = static_cast<long long>(fs::file_size(filename, ec));
+    ifstream in(filename, ios::binary);
+    if (ec || !in)
+    {
+        cerr << "Error opening file: " << filename << endl;
+        return;
+    }
+
+    DocId fileId = trie.addFile(filename.c_str());
+
+    // Move each nominal split point forward to the next whitespace byte
+    vector<long long> bounds;
+    bounds.push_back(0);
+    for (unsigned int i = 1; i < numThreads; i++)
+    {
+        long long offset = max(bounds.back(), fileSize * i / numThreads);
+        in.clear();
+        in.seekg(offset);
+        int ch;
+        while ((ch = in.get()) != EOF && !isspace(ch))
+        {
+            offset++;
+        }
+        if (offset >= fileSize)
+        {
+            break;
+        }
+        if (offset > bounds.back())
+        {
+            bounds.push_back(offset);
+        }
+    }
+    bounds.push_back(fileSize);
+
+    size_t chunkCount = bounds.size() - 1;
+    vector<ChunkResult> results(chunkCount);
+    vector<thread> threads;
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        threads.push_back(thread(indexChunk, cref(filename), bounds[i], bounds[i + 1], ref(trie), ref(results[i])));
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    // Merge in chunk order so global positions stay ascending
+    int positionOffset = 1;
+    vector<int> globalPositions;
+    for (auto &result : results)
+    {
+        for (auto &entry : result.postings)
+        {
+            globalPositions.clear();
+            for (int localPosition : entry.second.positions)
+            {
+                globalPositions.push_back(positionOffset + localPosition);
+            }
+            trie.insertPostings(entry.first.c_str(), fileId, entry.second.frequency,
+                                globalPositions.data(), globalPositions.size());
+        }
+        positionOffset += result.positionCount;
+    }
+
+    if (trie.trigramIndexEnabled())
+    {
+        for (size_t i = 1; i < results.size(); i++)
+        {
+            results[0].trigrams.merge(results[i].trigrams);
+        }
+        trie.addDocumentTrigrams(fileId, results[0].trigrams);
+    }
+    trie.finishDocument(fileId);
+}
+
+// Supplies paths to index one at a time; returns false once there are no
+// more. Indexers with several workers call it from all of them at once.
+using FileSource = function<bool(string &)>;
+
+// Source over a fixed list of files
+FileSource fileListSource(const vector<string> &files)
+{
+    auto next = make_shared<atomic<size_t>>(0);
+    return [&files, next](string &path)
+    {
+        size_t i = (*next)++;
+        if (i >= files.size())
+            return false;
+        path = files[i];
+        return true;
+    };
+}
+
+const int CRAWL_READAHEAD_FILES = 8; // Queued files hinted to the kernel ahead of the indexer
+
+// Walks a directory tree on several threads and streams the regular files
+// it finds, so indexing can start before the crawl ends. Entry types come
+// from readdir's d_type, so most entries need no stat call; each
+// directory's files are queued in one batch. Names matching an exclude
+// glob are skipped (whole subtrees for directories); if include globs are
+// given, a file must match one of them. Symlinked directories are not
+// followed, so the walk cannot loop.
+class DirectoryCrawler
+{
+private:
+    vector<string> includeGlobs, excludeGlobs;
+    vector<thread> workers;
+    mutex crawlMutex;
+    condition_variable changed;
+    deque<string> directories; // Waiting to be listed
+    deque<string> files;       // Found, not yet taken by the indexer
+    int busyWorkers = 0;
+    size_t hinted = 0;         // Leading entries of files already given readahead hints
+    long long filesFound = 0, directoriesListed = 0, entriesSkipped = 0;
+    chrono::steady_clock::time_point started, finished;
+
+    bool excluded(const char *name) const
+    {
+        for (const string &glob : excludeGlobs)
+        {
+            if (fnmatch(glob.c_str(), name, 0) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool included(const char *name) const
+    {
+        if (includeGlobs.empty())
+            return true;
+        for (const string &glob : includeGlobs)
+        {
+            if (fnmatch(glob.c_str(), name, 0) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    void listDirectory(const string &directory, vector<string> &subdirectories, vector<string> &found, long long &skipped)
+    {
+        DIR *dir = opendir(directory.c_str());
+        if (!dir)
+        {
+            cerr << "Cannot open directory " << directory << ": " << strerror(errno) << "\n";
+            return;
+        }
+        string prefix = directory.back() == '/' ? directory : directory + "/";
+        while (dirent *entry = readdir(dir))
+        {
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN || type == DT_LNK)
+            {
+                // Only these need a stat: symlinks count as the file they point to
+                struct stat info;
+                int flags = type == DT_UNKNOWN ? AT_SYMLINK_NOFOLLOW : 0;
+                if (fstatat(dirfd(dir), name, &info, flags) != 0)
+                    continue;
+                type = S_ISREG(info.st_mode) ? DT_REG : (S_ISDIR(info.st_mode) && type == DT_UNKNOWN ? DT_DIR : DT_UNKNOWN);
+            }
+
+            if (type == DT_DIR)
+            {
+                if (excluded(name))
+                    skipped++;
+                else
+                    subdirectories.push_back(prefix + name);
+            }
+            else if (type == DT_REG)
+            {
+                if (excluded(name) || !included(name))
+                    skipped++;
+                else
+                    found.push_back(prefix + name);
+            }
+        }
+        closedir(dir);
+    }
+
+    void work()
+    {
+        unique_lock<mutex> lock(crawlMutex);
+        while (true)
+        {
+            changed.wait(lock, [this]
+                         { return !directories.empty() || busyWorkers == 0; });
+            if (directories.empty())
+                break; // Nothing queued and nobody can queue more
+
+            string directory = move(directories.front());
+            directories.pop_front();
+            busyWorkers++;
+            lock.unlock();
+
+            vector<string> subdirectories, found;
+            long long skipped = 0;
+            listDirectory(directory, subdirectories, found, skipped);
+
+            lock.lock();
+            busyWorkers--;
+            directoriesListed++;
+            entriesSkipped += skipped;
+            filesFound += found.size();
+            for (string &path : subdirectories)
+                directories.push_back(move(path));
+            for (string &path : found)
+                files.push_back(move(path));
+            if (directories.empty() && busyWorkers == 0)
+                finished = chrono::steady_clock::now();
+            changed.notify_all();
+        }
+    }
+
+    static void readaheadHint(const string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+
+public:
+    ~DirectoryCrawler()
+    {
+        wait();
+    }
+
+    // Start crawling root with threadCount workers
+    void start(const string &root, const vector<string> &include, const vector<string> &exclude, unsigned threadCount)
+    {
+        includeGlobs = include;
+        excludeGlobs = exclude;
+        started = chrono::steady_clock::now();
+        directories.push_back(root);
+        for (unsigned i = 0; i < max(1u, threadCount); i++)
+            workers.emplace_back(&DirectoryCrawler::work, this);
+    }
+
+    // Next file found, waiting while the crawl is still running; false once
+    // the crawl has finished and every file has been taken. Safe to call
+    // from several indexing threads.
+    bool next(string &path)
+    {
+        vector<string> hints;
+        {
+            unique_lock<mutex> lock(crawlMutex);
+            changed.wait(lock, [this]
+                         { return !files.empty() || (directories.empty() && busyWorkers == 0); });
+            if (files.empty())
+                return false;
+            path = move(files.front());
+            files.pop_front();
+            hinted = hinted > 0 ? hinted - 1 : 0;
+
+            // Let the kernel start reading the files the indexer takes next
+            for (; hinted < files.size() && hinted < static_cast<size_t>(CRAWL_READAHEAD_FILES); hinted++)
+                hints.push_back(files[hinted]);
+        }
+        for (const string &hint : hints)
+            readaheadHint(hint);
+        return true;
+    }
+
+    void wait()
+    {
+        for (thread &worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    // Print files found and discovery rate; call after wait()
+    void report() const
+    {
+        long long micros = max(1LL, static_cast<long long>(chrono::duration_cast<chrono::microseconds>(finished - started).count()));
+        cout << "Crawled " << directoriesListed << " directories in " << micros / 1000 << " ms: " << filesFound
+             << " files found (" << static_cast<long long>(filesFound * 1e6 / micros) << " files/sec), "
+             << entriesSkipped << " entries filtered out.\n";
+    }
+};
+
+const int QUEUE_SPIN_LIMIT = 64; // Polls before a pipeline stage sleeps on its queue
+
+// Lock-free single-producer/single-consumer ring buffer connecting two
+// pipeline stages. Capacity is rounded up to a power of two. A stage that
+// finds the queue full or empty polls briefly, then sleeps on a condition
+// variable; the mutex is only touched while someone is asleep.
+template <typename T>
+class BoundedQueue
+{
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head; // Next slot to pop, owned by the consumer
+    alignas(64) atomic<size_t> tail; // Next slot to push, owned by the producer
+    alignas(64) atomic<int> sleepers;
+    mutex sleepMutex;
+    condition_variable moved;
+
+    // Wake the other stage if it is asleep. The fence pairs with the one in
+    // waitUntil so a sleeper either sees the new index or is counted here.
+    void wakeSleepers()
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleepers.load(memory_order_relaxed) > 0)
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            moved.notify_all();
+        }
+    }
+
+    template <typename Ready>
+    void waitUntil(Ready ready)
+    {
+        for (int i = 0; i < QUEUE_SPIN_LIMIT; i++)
+        {
+            if (ready())
+                return;
+            this_thread::yield();
+        }
+        sleepers.fetch_add(1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        {
+            unique_lock<mutex> lock(sleepMutex);
+            moved.wait(lock, ready);
+        }
+        sleepers.fetch_sub(1, memory_order_relaxed);
+    }
+
+public:
+    explicit BoundedQueue(size_t capacity) : head(0), tail(0), sleepers(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    bool tryPush(T &item)
+    {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) > mask)
+        {
+            return false; // Full
+        }
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, memory_order_release);
+        wakeSleepers();
+        return true;
+    }
+
+    bool tryPop(T &item)
+    {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == tail.load(memory_order_acquire))
+        {
+            return false; // Empty
+        }
+        item = std::move(slots[h & mask]);
+        head.store(h + 1, memory_order_release);
+        wakeSleepers();
+        return true;
+    }
+
+    // Block the producer until a slot is free
+    void waitUntilNotFull()
+    {
+        waitUntil([this]()
+                  { return tail.load(memory_order_relaxed) - head.load(memory_order_acquire) <= mask; });
+    }
+
+    // Block the consumer until an item is queued
+    void waitUntilNotEmpty()
+    {
+        waitUntil([this]()
+                  { return head.load(memory_order_relaxed) != tail.load(memory_order_acquire); });
+    }
+};
+
+// Throughput counters for one pipeline stage. Each stage runs on a single
+// thread, so plain fields are safe to read once the stage has been joined.
+struct StageCounters
+{
+    const char *name;
+    long long items = 0;
+    long long bytes = 0;
+    long long waitInputMicros = 0;  // Starved: upstream queue empty
+    long long waitOutputMicros = 0; // Backpressure: downstream queue full
+    long long totalMicros = 0;
+
+    explicit StageCounters(const char *stageName) : name(stageName) {}
+
+    void report() const
+    {
+        double seconds = max(totalMicros, 1LL) / 1e6;
+        cout << "  " << left << setw(10) << name << right
+             << setw(10) << items << " items, "
+             << fixed << setprecision(1) << setw(8) << (bytes / 1048576.0) / seconds << " MB/s, "
+             << "starved " << setw(5) << 100.0 * waitInputMicros / max(totalMicros, 1LL) << "%, "
+             << "blocked " << setw(5) << 100.0 * waitOutputMicros / max(totalMicros, 1LL) << "%\n";
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+    }
+};
+
+// Raw bytes read from a file; endOfFile marks the last block of that file
+struct ReadBlock
+{
+    int fileId = -1;
+    bool endOfFile = false;
+    bool endOfStream = false;
+    vector<char> data;
+};
+
+// Normalized words (NUL separated) with their positions, ready for insert;
+// endOfFile marks the last batch of that file
+struct TokenBatch
+{
+    int fileId = -1;
+    bool endOfFile = false;
+    bool endOfStream = false;
+    vector<char> words;
+    vector<int> positions;
+};
+
+const size_t PIPELINE_QUEUE_CAPACITY = 64;
+const size_t PIPELINE_BATCH_TOKENS = 4096;
+
+// Wait until the item is accepted, charging the time to the stage's output wait
+template <typename T>
+void pushWithBackpressure(BoundedQueue<T> &queue, T &item, StageCounters &counters)
+{
+    if (queue.tryPush(item))
+        return;
+    auto start = chrono::steady_clock::now();
+    while (!queue.tryPush(item))
+    {
+        queue.waitUntilNotFull();
+    }
+    counters.waitOutputMicros += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+template <typename T>
+void popWithWait(BoundedQueue<T> &queue, T &item, StageCounters &counters)
+{
+    if (queue.tryPop(item))
+        return;
+    auto start = chrono::steady_clock::now();
+    while (!queue.tryPop(item))
+    {
+        queue.waitUntilNotEmpty();
+    }
+    counters.waitInputMicros += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Index files with three overlapping stages: reader -> tokenizer -> inserter.
+// Disk reads, tokenizing and trie inserts each get their own thread so I/O
+// and CPU work proceed concurrently; per-stage counters show the bottleneck.
+void processFilesPipelined(const FileSource &nextFile, Trie &trie)
+{
+    BoundedQueue<ReadBlock> blocks(PIPELINE_QUEUE_CAPACITY);
+    BoundedQueue<TokenBatch> batches(PIPELINE_QUEUE_CAPACITY);
+    StageCounters readStats("read"), tokenizeStats("tokenize"), insertStats("insert");
+
+    thread reader([&]()
+                  {
+        auto start = chrono::steady_clock::now();
+        string filename;
+        while (nextFile(filename))
+        {
+            FILE *file = fopen(filename.c_str(), "rb");
+            if (!file)
+            {
+                cerr << "Error opening file: " << filename << endl;
+                continue;
+            }
+            DocId fileId = trie.addFile(filename.c_str());
+
+            while (true)
+            {
+                ReadBlock block;
+                block.fileId = fileId;
+                block.data.resize(CHUNK_READ_BUFFER_SIZE);
+                size_t got = fread(block.data.data(), 1, block.data.size(), file);
+                block.data.resize(got);
+                block.endOfFile = got < static_cast<size_t>(CHUNK_READ_BUFFER_SIZE);
+                readStats.items++;
+                readStats.bytes += got;
+                bool last = block.endOfFile;
+                pushWithBackpressure(blocks, block, readStats);
+                if (last)
+                    break;
+            }
+            fclose(file);
+        }
+        ReadBlock done;
+        done.endOfStream = true;
+        pushWithBackpressure(blocks, done, readStats);
+        readStats.totalMicros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count(); });
+
+    thread tokenizer([&]()
+                     {
+        auto start = chrono::steady_clock::now();
+        TokenSplitter splitter;
+        TokenBatch batch;
+        int position = 1;
+        bool collectTrigrams = trie.trigramIndexEnabled();
+        TrigramCollector trigrams;
+
+        auto flushBatch = [&]()
+        {
+            if (batch.positions.empty() && !batch.endOfFile)
+                return;
+            int fileId = batch.fileId;
+            pushWithBackpressure(batches, batch, tokenizeStats);
+            batch = TokenBatch();
+            batch.fileId = fileId;
+        };
+
+        auto addWord = [&](const char *word)
+        {
+            if (collectTrigrams)
+                trigrams.addToken(word);
+
+            char cleanedWord[MAX_WORD_LENGTH];
+            if (!normalizeToken(word, cleanedWord, trie))
+                return;
+            size_t length = strlen(cleanedWord);
+            if (length > 0)
+            {
+                batch.words.insert(batch.words.end(), cleanedWord, cleanedWord + length + 1);
+                batch.positions.push_back(position);
+                tokenizeStats.items++;
+                if (batch.positions.size() >= PIPELINE_BATCH_TOKENS)
+                    flushBatch();
+            }
+            position++;
+        };
+
+        while (true)
+        {
+            ReadBlock block;
+            popWithWait(blocks, block, tokenizeStats);
+            if (block.endOfStream)
+                break;
+
+            if (block.fileId != batch.fileId)
+            {
+                flushBatch();
+                batch.fileId = block.fileId;
+            }
+            tokenizeStats.bytes += block.data.size();
+            splitter.feed(block.data.data(), block.data.size(), addWord);
+            if (block.endOfFile)
+            {
+                splitter.finish(addWord);
+                batch.endOfFile = true;
+                flushBatch();
+                position = 1;
+                if (collectTrigrams)
+                {
+                    trie.addDocumentTrigrams(block.fileId, trigrams);
+                    trigrams = TrigramCollector();
+                }
+            }
+        }
+
+        TokenBatch done;
+        done.endOfStream = true;
+        pushWithBackpressure(batches, done, tokenizeStats);
+        tokenizeStats.totalMicros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count(); });
+
+    // The calling thread acts as the inserter stage
+    auto start = chrono::steady_clock::now();
+    while (true)
+    {
+        TokenBatch batch;
+        popWithWait(batches, batch, insertStats);
+        if (batch.endOfStream)
+            break;
+
+        const char *word = batch.words.data();
+        for (int position : batch.positions)
+        {
+            size_t length = strlen(word);
+            trie.insert(word, batch.fileId, position);
+            insertStats.items++;
+            insertStats.bytes += length + 1;
+            word += length + 1;
+        }
+        if (batch.endOfFile)
+            trie.finishDocument(batch.fileId);
+    }
+    insertStats.totalMicros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+    reader.join();
+    tokenizer.join();
+
+    cout << "Pipeline stage statistics:\n";
+    readStats.report();
+    tokenizeStats.report();
+    insertStats.report();
+}
+
+void processFilesPipelined(const vector<string> &files, Trie &trie)
+{
+    processFilesPipelined(fileListSource(files), trie);
+}
+
+// New utility functions using added libraries
+namespace Utils
+{
+    // Get current timestamp using chrono
+    string getTimestamp()
+    {
+        auto now = chrono::system_clock::now();
+        auto time = chrono::system_clock::to_time_t(now);
+        stringstream ss;
+        ss << put_time(localtime(&time), "%Y-%m-%d %H:%M:%S");
+        return ss.str();
+    }
+
+    // Get all files in a directory using filesystem
+    vector<string> getFilesInDirectory(const string &directory)
+    {
+        vector<string> files;
+        try
+        {
+            for (const auto &entry : fs::directory_iterator(directory))
+            {
+                if (entry.is_regular_file())
+                {
+                    files.push_back(entry.path().string());
+                }
+            }
+        }
+        catch (const fs::filesystem_error &e)
+        {
+            cerr << "Filesystem error: " << e.what() << endl;
+        }
+        return files;
+    }
+
+    // Regular expression word validation
+    bool isValidWord(const string &word)
+    {
+        static const regex wordRegex("^[a-zA-Z]+$");
+        return regex_match(word, wordRegex);
+    }
+
+    // Random word selection using random library
+    string getRandomWord(const vector<string> &words)
+    {
+        if (words.empty())
+            return "";
+
+        random_device rd;
+        mt19937 gen(rd());
+        uniform_int_distribution<> distrib(0, words.size() - 1);
+
+        return words[distrib(gen)];
+    }
+
+    // Multithreaded file processing
+    void processFilesParallel(const FileSource &nextFile, Trie &trie)
+    {
+        const unsigned int maxThreads = max(1u, thread::hardware_concurrency());
+
+        // Files are taken one at a time by every thread. Large files are set
+        // aside and afterwards split into chunks so each one uses every core.
+        mutex largeFilesMutex;
+        vector<string> largeFiles;
+        vector<thread> threads;
+        for (unsigned int i = 0; i < maxThreads; i++)
+        {
+            threads.push_back(thread([&]()
+                                     {
+                string file;
+                while (nextFile(file)) {
+                    error_code ec;
+                    auto size = fs::file_size(file, ec);
+                    if (!ec && maxThreads > 1 && static_cast<long long>(size) >= CHUNKED_INDEX_MIN_BYTES) {
+                        lock_guard<mutex> lock(largeFilesMutex);
+                        largeFiles.push_back(file);
+                    } else {
+                        processFile(file, trie);
+                    }
+                } }));
+        }
+
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+        for (const auto &file : largeFiles)
+        {
+            processFileChunked(file, trie, maxThreads);
+        }
+    }
+
+    void processFilesParallel(const vector<string> &files, Trie &trie)
+    {
+        processFilesParallel(fileListSource(files), trie);
+    }
+
+    // String utility for unicode handling with locale
+    string toUpperCase(const string &input)
+    {
+        string result = input;
+        locale loc("en_US.UTF-8");
+        for (auto &c : result)
+        {
+            c = toupper(c, loc);
+        }
+        return result;
+    }
+
+    // Smart pointer example for memory management
+    shared_ptr<vector<string>> createWordVector(const string &text)
+    {
+        auto words = make_shared<vector<string>>();
+        istringstream iss(text);
+        string word;
+        while (iss >> word)
+        {
+            if (isValidWord(word))
+            {
+                words->push_back(word);
+            }
+        }
+        return words;
+    }
+}
+
+// Menu system
+void displayMenu()
+{
+    cout << "\nMini Search Engine\n";
+    cout << "1. Search Word\n";
+    cout << "2. Partial Search\n";
+    cout << "3. Autocomplete\n";
+    cout << "4. Show Word Details\n";
+    cout << "5. Advanced Search\n";
+    cout << "6. Spell Check\n";
+    cout << "7. Proximity Search\n";
+    cout << "8. Search History\n";
+    cout << "9. Export Results\n";
+    cout << "10. Exit\n";
+    cout << "11. Background Auto-Indexing\n";
+    cout << "12. Sharded Search\n";
+    cout << "13. Index Tools\n";
+    cout << "14. Wildcard Search\n";
+    cout << "15. Suffix/Infix Search\n";
+    cout << "16. Substring Search\n";
+    cout << "Choice: ";
+}
+
+// Tokens of a file fed to a trigram collector, as processFile does
+void collectFileTrigrams(const char *filename, TrigramCollector &trigrams)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file)
+        return;
+    char word[MAX_WORD_LENGTH];
+    while (fscanf(file, "%99s", word) == 1)
+        trigrams.addToken(word);
+    fclose(file);
+}
+
+struct RecoveryReport
+{
+    long long snapshotDocuments; // -1 if there was no usable snapshot
+    long long logRecords;
+    int reindexed, removed;
+};
+
+// Rebuild the index left by the last session: load its snapshot, then
+// replay the write-ahead log on top, re-indexing only the files added
+// since the snapshot was taken or still being indexed when it was
+RecoveryReport recoverIndex(Trie &trie)
+{
+    RecoveryReport report{-1, 0, 0, 0};
+    if (fs::exists(SNAPSHOT_FILE))
+    {
+        bool trigramsRestored = false;
+        report.snapshotDocuments = trie.loadSnapshot(SNAPSHOT_FILE, trigramsRestored);
+        if (report.snapshotDocuments < 0)
+        {
+            cerr << "Snapshot " << SNAPSHOT_FILE << " is unreadable, corrupt or built for another alphabet; ignoring it.\n";
+        }
+        else if (trie.trigramIndexEnabled() && !trigramsRestored)
+        {
+            // The snapshot was taken without a trigram index
+            for (DocId id = 0; id < report.snapshotDocuments; id++)
+            {
+                if (trie.isDocumentPending(id))
+                    continue;
+                TrigramCollector trigrams;
+                collectFileTrigrams(trie.getFilename(id), trigrams);
+                trie.addDocumentTrigrams(id, trigrams);
+            }
+        }
+
+        // Files caught mid-indexing by the checkpoint; one that has since
+        // disappeared is dropped instead
+        for (DocId id = 0; id < max(report.snapshotDocuments, 0LL); id++)
+        {
+            if (!trie.isDocumentPending(id))
+                continue;
+            processFile(trie.getFilename(id), trie);
+            report.reindexed++;
+            if (trie.isDocumentPending(id))
+            {
+                trie.finishDocument(id);
+                trie.markDocumentDeleted(id);
+                report.removed++;
+            }
+        }
+    }
+
+    report.logRecords = WriteAheadLog::replay(WAL_FILE, [&](uint8_t type, const string &path)
+                                              {
+        long long id = trie.findFileId(path.c_str());
+        if (type == WriteAheadLog::ADD_DOCUMENT && (id < 0 || trie.isDocumentDeleted(id)))
+        {
+            // A removed path added again was re-created or rewritten
+            if (id >= 0)
+                trie.replaceFile(path.c_str());
+            processFile(path, trie);
+            report.reindexed++;
+        }
+        else if (type == WriteAheadLog::REMOVE_DOCUMENT && id >= 0 && !trie.isDocumentDeleted(id))
+        {
+            trie.markDocumentDeleted(id);
+            report.removed++;
+        } });
+    if (report.logRecords < 0)
+    {
+        cerr << "Could not read " << WAL_FILE << ".\n";
+    }
+    return report;
+}
+
+const int WATCH_COALESCE_MS = 250;        // A path must be quiet this long before it is reported
+const int WATCH_POLL_INTERVAL_SECONDS = 30; // Rescan period when inotify is unavailable
+
+// Reports files created, rewritten or removed anywhere under a directory.
+// inotify watches every subdirectory (new ones are watched as they
+// appear); a file is reported once it is closed after writing or moved
+// in, and events for a path are coalesced until it has been quiet for
+// WATCH_COALESCE_MS, so a file written in many pieces is reported once.
+// When inotify cannot be used, or its queue overflows, the tree is
+// rescanned and compared, by modification time, with the files seen so
+// far instead.
+class DirectoryWatcher
+{
+public:
+    struct Change
+    {
+        string path;
+        bool removed;
+        bool modified; // Written again after it was last reported
+    };
+
+private:
+    string rootDirectory;
+    int inotifyFd = -1;
+    unordered_map<int, string> watchedDirectories; // Watch descriptor -> directory
+    unordered_map<string, pair<bool, chrono::steady_clock::time_point>> pending; // Path -> (removed, last event)
+    unordered_map<string, fs::file_time_type> knownFiles; // Reported file -> modification time then
+    chrono::steady_clock::time_point nextScan;
+
+    void note(const string &path, bool removed)
+    {
+        pending[path] = {removed, chrono::steady_clock::now()};
+    }
+
+    // Watch dir and everything below it; files found there are reported,
+    // since they may have been created before the watch existed
+    bool watchTree(const string &dir)
+    {
+        const uint32_t mask = IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR;
+        int wd = inotify_add_watch(inotifyFd, dir.c_str(), mask);
+        if (wd < 0)
+            return false;
+        watchedDirectories[wd] = dir;
+
+        error_code error;
+        for (fs::directory_iterator it(dir, error), end; !error && it != end; it.increment(error))
+        {
+            if (it->is_directory(error))
+            {
+                if (!watchTree(it->path().string()))
+                    return false;
+            }
+            else if (it->is_regular_file(error) && !knownFiles.count(it->path().string()))
+            {
+                note(it->path().string(), false);
+            }
+        }
+        return true;
+    }
+
+    // A directory moved away or deleted: its files are gone and its watches
+    // would report under a stale name
+    void forgetTree(const string &dir)
+    {
+        string prefix = dir + "/";
+        for (const auto &file : knownFiles)
+        {
+            if (file.first.compare(0, prefix.size(), prefix) == 0)
+                note(file.first, true);
+        }
+        for (auto it = watchedDirectories.begin(); it != watchedDirectories.end();)
+        {
+            if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0)
+            {
+                inotify_rm_watch(inotifyFd, it->first);
+                it = watchedDirectories.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    void stopInotify()
+    {
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+        inotifyFd = -1;
+        watchedDirectories.clear();
+    }
+
+    // Compare the whole tree with the files seen so far
+    void rescan()
+    {
+        unordered_map<string, fs::file_time_type> present;
+        error_code error;
+        for (fs::recursive_directory_iterator it(rootDirectory, error), end; !error && it != end; it.increment(error))
+        {
+            if (it->is_regular_file(error))
+                present[it->path().string()] = it->last_write_time(error);
+        }
+        for (const auto &file : present)
+        {
+            auto known = knownFiles.find(file.first);
+            if (known == knownFiles.end() || known->second != file.second)
+                note(file.first, false);
+        }
+        for (const auto &file : knownFiles)
+        {
+            if (!present.count(file.first))
+                note(file.first, true);
+        }
+        nextScan = chrono::steady_clock::now() + chrono::seconds(WATCH_POLL_INTERVAL_SECONDS);
+    }
+
+    void readEvents()
+    {
+        alignas(inotify_event) char buffer[64 * 1024];
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *p = buffer; p < buffer + length;)
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(p);
+                p += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    // Events were lost: fall back on comparing the tree
+                    rescan();
+                    continue;
+                }
+                auto dir = watchedDirectories.find(event->wd);
+                if (event->mask & IN_IGNORED)
+                {
+                    if (dir != watchedDirectories.end())
+                        watchedDirectories.erase(dir);
+                    continue;
+                }
+                if (dir == watchedDirectories.end() || event->len == 0)
+                    continue;
+
+                string path = dir->second + "/" + event->name;
+                if (event->mask & IN_ISDIR)
+                {
+                    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !watchTree(path))
+                    {
+                        cerr << "Watcher: cannot watch " << path << " (" << strerror(errno)
+                             << "); polling every " << WATCH_POLL_INTERVAL_SECONDS << " seconds instead\n";
+                        stopInotify();
+                        rescan();
+                        return;
+                    }
+                    if (event->mask & (IN_MOVED_FROM | IN_DELETE))
+                        forgetTree(path);
+                    continue;
+                }
+                // A file just created is still being written; wait for IN_CLOSE_WRITE
+                if (event->mask & IN_CREATE)
+                    continue;
+                note(path, (event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0);
+            }
+        }
+    }
+
+public:
+    ~DirectoryWatcher()
+    {
+        stopInotify();
+    }
+
+    // Start watching directory; every file already there is reported by
+    // the first waitForChanges. Returns false if only polling is available.
+    bool start(const string &directory)
+    {
+        rootDirectory = directory;
+        while (rootDirectory.size() > 1 && rootDirectory.back() == '/')
+            rootDirectory.pop_back();
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0 && watchTree(rootDirectory))
+        {
+            nextScan = chrono::steady_clock::time_point::max();
+            return true;
+        }
+        stopInotify();
+        pending.clear();
+        rescan();
+        return false;
+    }
+
+    bool usingInotify() const
+    {
+        return inotifyFd >= 0;
+    }
+
+    // Block for up to timeoutMs and return the changes that have settled
+    vector<Change> waitForChanges(int timeoutMs)
+    {
+        auto now = chrono::steady_clock::now();
+        auto deadline = now + chrono::milliseconds(timeoutMs);
+        // Wake early for a pending path that is about to settle or a rescan that is due
+        for (const auto &entry : pending)
+            deadline = min(deadline, entry.second.second + chrono::milliseconds(WATCH_COALESCE_MS));
+        deadline = min(deadline, nextScan);
+        int waitMs = max<long long>(0, chrono::duration_cast<chrono::milliseconds>(deadline - now).count());
+
+        if (inotifyFd >= 0)
+        {
+            pollfd descriptor{inotifyFd, POLLIN, 0};
+            if (::poll(&descriptor, 1, waitMs) > 0)
+                readEvents();
+        }
+        else
+        {
+            this_thread::sleep_for(chrono::milliseconds(waitMs));
+        }
+        if (chrono::steady_clock::now() >= nextScan)
+            rescan();
+
+        vector<Change> settled;
+        now = chrono::steady_clock::now();
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            if (now - it->second.second < chrono::milliseconds(WATCH_COALESCE_MS))
+            {
+                ++it;
+                continue;
+            }
+            bool removed = it->second.first;
+            settled.push_back({it->first, removed, !removed && knownFiles.count(it->first) > 0});
+            error_code error;
+            if (removed)
+                knownFiles.erase(it->first);
+            else
+                knownFiles[it->first] = fs::last_write_time(it->first, error);
+            it = pending.erase(it);
+        }
+        return settled;
+    }
+};
+
+// Background indexing thread function: index files as they appear or
+// change under directory and drop removed ones from results
+void backgroundIndexing(Trie &trie, const string &directory, atomic<bool> &running)
+{
+    DirectoryWatcher watcher;
+    if (watcher.start(directory))
+    {
+        cout << "Background indexing started (watching for changes)...\n";
+    }
+    else
+    {
+        cout << "Background indexing started (inotify unavailable, polling every "
+             << WATCH_POLL_INTERVAL_SECONDS << " seconds)...\n";
+    }
+
+    while (running)
+    {
+        // Short timeout so a stop request is noticed promptly
+        for (const DirectoryWatcher::Change &change : watcher.waitForChanges(500))
+        {
+            long long id = trie.findFileId(change.path.c_str());
+            if (change.removed)
+            {
+                if (id >= 0 && !trie.isDocumentDeleted(id))
+                {
+                    cout << "Background indexing: removed " << change.path << "\n";
+                    trie.markDocumentDeleted(id);
+                }
+            }
+            else if (id < 0)
+            {
+                cout << "Background indexing: " << change.path << "\n";
+                processFile(change.path, trie);
+            }
+            else if (change.modified || trie.isDocumentDeleted(id))
+            {
+                // Postings cannot be replaced in place: the old version is
+                // tombstoned and the file indexed again under a new id
+                cout << "Background indexing: re-indexing " << change.path << "\n";
+                trie.replaceFile(change.path.c_str());
+                processFile(change.path, trie);
+            }
+        }
+
+        // Between files is a natural point to fold a long log into a new
+        // snapshot; files still being indexed elsewhere are kept pending
+        if (trie.loggedRecords() >= WAL_CHECKPOINT_RECORDS && !trie.checkpoint(SNAPSHOT_FILE))
+        {
+            cerr << "Background indexing: could not write " << SNAPSHOT_FILE << "\n";
+        }
+    }
+
+    cout << "Background indexing stopped.\n";
+}
+
+// Sharded mode: documents are partitioned across shard processes that each
+// own a Trie, and a coordinator fans queries out over local sockets.
+
+// Newline delimited messages over a connected socket
+class LineChannel
+{
+private:
+    int fd;
+    string pending;
+
+public:
+    explicit LineChannel(int socketFd = -1) : fd(socketFd) {}
+
+    int descriptor() const
+    {
+        return fd;
+    }
+
+    // Take one complete buffered line, if any
+    bool popLine(string &line)
+    {
+        size_t newline = pending.find('\n');
+        if (newline == string::npos)
+            return false;
+        line = pending.substr(0, newline);
+        pending.erase(0, newline + 1);
+        return true;
+    }
+
+    // Read whatever is available; false on EOF or error
+    bool fill()
+    {
+        char buffer[4096];
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got <= 0)
+            return false;
+        pending.append(buffer, got);
+        return true;
+    }
+
+    bool readLine(string &line)
+    {
+        while (!popLine(line))
+        {
+            if (!fill())
+                return false;
+        }
+        return true;
+    }
+
+    bool sendLine(const string &line)
+    {
+        string data = line + "\n";
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            // MSG_NOSIGNAL: a dead peer must not kill us with SIGPIPE
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+// Shard side of the protocol. Requests are single lines:
+//   STATS w1 w2 ...            -> "N <docs>" then "DF <df>" per word
+//   AND|ANY <k> w1 idf1 ...    -> "<score>\t<path>" per matching doc, best first
+//   QUIT
+// Every reply ends with a line containing a single ".".
+void runShardServer(LineChannel &channel, Trie &trie)
+{
+    string line;
+    while (channel.readLine(line))
+    {
+        istringstream request(line);
+        string op;
+        request >> op;
+
+        if (op == "QUIT")
+        {
+            break;
+        }
+        else if (op == "STATS")
+        {
+            channel.sendLine("N " + to_string(trie.getFileCount()));
+            string word;
+            while (request >> word)
+            {
+                char key[MAX_WORD_LENGTH];
+                snprintf(key, sizeof(key), "%s", word.c_str());
+                trie.stem(key);
+                TrieNode *node = trie.findNode(key);
+                channel.sendLine("DF " + to_string(node ? node->fileInfoCount : 0));
+            }
+        }
+        else if (op == "AND" || op == "ANY")
+        {
+            int topK = 0;
+            request >> topK;
+
+            // fileId -> (terms matched, tf-idf score)
+            unordered_map<int, pair<int, double>> scores;
+            int termCount = 0;
+            string word;
+            double idf;
+            while (request >> word >> idf)
+            {
+                termCount++;
+                char key[MAX_WORD_LENGTH];
+                snprintf(key, sizeof(key), "%s", word.c_str());
+                trie.stem(key);
+                TrieNode *node = trie.findNode(key);
+                if (!node)
+                    continue;
+                vector<FileInfo> scratch;
+                for (const FileInfo &info : trie.postingsOf(node, scratch))
+                {
+                    auto &entry = scores[info.fileId];
+                    entry.first++;
+                    entry.second += info.frequency * idf;
+                }
+            }
+
+            vector<pair<double, int>> hits;
+            for (auto &entry : scores)
+            {
+                if (op == "ANY" || entry.second.first == termCount)
+                {
+                    hits.push_back({entry.second.second, entry.first});
+                }
+            }
+            sort(hits.begin(), hits.end(), [](const pair<double, int> &a, const pair<double, int> &b)
+                 { return a.first > b.first; });
+            if (topK > 0 && hits.size() > static_cast<size_t>(topK))
+            {
+                hits.resize(topK);
+            }
+
+            for (auto &hit : hits)
+            {
+                char score[32];
+                snprintf(score, sizeof(score), "%.6f", hit.first);
+                channel.sendLine(string(score) + "\t" + trie.getFilename(hit.second));
+            }
+        }
+        channel.sendLine(".");
+    }
+}
+
+struct ShardHit
+{
+    double score;
+    string path;
+};
+
+class ShardCoordinator
+{
+private:
+    struct Shard
+    {
+        pid_t pid;
+        LineChannel channel;
+        int fileCount;
+    };
+    vector<Shard> shards;
+
+    // Send one request to every shard, then gather all replies concurrently.
+    // On failure the shards are stopped: the ones that did get the request
+    // would otherwise leave replies queued for the next query to read.
+    bool scatterGather(const string &request, vector<vector<string>> &replies, vector<double> &latencyMicros)
+    {
+        if (!exchange(request, replies, latencyMicros))
+        {
+            stop();
+            return false;
+        }
+        return true;
+    }
+
+    bool exchange(const string &request, vector<vector<string>> &replies, vector<double> &latencyMicros)
+    {
+        size_t count = shards.size();
+        replies.assign(count, vector<string>());
+        latencyMicros.assign(count, 0);
+        vector<bool> done(count, false);
+
+        auto start = chrono::steady_clock::now();
+        for (auto &shard : shards)
+        {
+            if (!shard.channel.sendLine(request))
+                return false;
+        }
+
+        size_t remaining = count;
+        while (remaining > 0)
+        {
+            vector<pollfd> fds;
+            vector<size_t> owners;
+            for (size_t i = 0; i < count; i++)
+            {
+                if (!done[i])
+                {
+                    fds.push_back({shards[i].channel.descriptor(), POLLIN, 0});
+                    owners.push_back(i);
+                }
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0)
+                return false;
+
+            for (size_t f = 0; f < fds.size(); f++)
+            {
+                if (!(fds[f].revents & (POLLIN | POLLHUP | POLLERR)))
+                    continue;
+                size_t i = owners[f];
+                if (!shards[i].channel.fill())
+                    return false; // Shard died mid-reply
+
+                string line;
+                while (!done[i] && shards[i].channel.popLine(line))
+                {
+                    if (line == ".")
+                    {
+                        done[i] = true;
+                        remaining--;
+                        latencyMicros[i] = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+                    }
+                    else
+                    {
+                        replies[i].push_back(line);
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+public:
+    ~ShardCoordinator()
+    {
+        stop();
+    }
+
+    bool running() const
+    {
+        return !shards.empty();
+    }
+
+    int shardCount() const
+    {
+        return shards.size();
+    }
+
+    int shardFileCount(int shard) const
+    {
+        return shards[shard].fileCount;
+    }
+
+    // Fork one process per shard; each indexes its share of files
+    bool start(const vector<string> &files, int shardCount)
+    {
+        stop();
+        cout.flush();
+        cerr.flush();
+
+        for (int s = 0; s < shardCount; s++)
+        {
+            int sockets[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0)
+            {
+                cerr << "socketpair failed: " << strerror(errno) << endl;
+                stop();
+                return false;
+            }
+
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                cerr << "fork failed: " << strerror(errno) << endl;
+                ::close(sockets[0]);
+                ::close(sockets[1]);
+                stop();
+                return false;
+            }
+
+            if (pid == 0)
+            {
+                // Shard process: drop the coordinator's ends of every socket
+                ::close(sockets[0]);
+                for (auto &shard : shards)
+                {
+                    shard.channel.close();
+                }
+
+                Trie shardTrie;
+                for (size_t j = 0; j < files.size(); j++)
+                {
+                    if (hash<string>()(files[j]) % shardCount == static_cast<size_t>(s))
+                    {
+                        processFile(files[j], shardTrie);
+                    }
+                }
+
+                LineChannel channel(sockets[1]);
+                channel.sendLine("READY " + to_string(shardTrie.getFileCount()));
+                runShardServer(channel, shardTrie);
+                channel.close();
+                _exit(0);
+            }
+
+            ::close(sockets[1]);
+            shards.push_back({pid, LineChannel(sockets[0]), 0});
+        }
+
+        // Wait for every shard to finish indexing
+        for (auto &shard : shards)
+        {
+            string line;
+            if (!shard.channel.readLine(line) || line.compare(0, 6, "READY ") != 0)
+            {
+                cerr << "Shard " << shard.pid << " failed to start" << endl;
+                stop();
+                return false;
+            }
+            shard.fileCount = atoi(line.c_str() + 6);
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        for (auto &shard : shards)
+        {
+            shard.channel.sendLine("QUIT");
+            shard.channel.close();
+            waitpid(shard.pid, nullptr, 0);
+        }
+        shards.clear();
+    }
+
+    // Run an AND (requireAll) or ranked OR query across all shards and merge.
+    // Global IDF is gathered first so shard scores are directly comparable,
+    // which lets each shard return only its local top-k.
+    bool query(const vector<string> &words, bool requireAll, int topK,
+               vector<ShardHit> &hits, vector<double> &latencyMicros)
+    {
+        hits.clear();
+        if (words.empty() || shards.empty())
+            return false;
+
+        string statsRequest = "STATS";
+        for (const auto &word : words)
+        {
+            statsRequest += " " + word;
+        }
+
+        vector<vector<string>> replies;
+        vector<double> statsLatency;
+        if (!scatterGather(statsRequest, replies, statsLatency))
+            return false;
+
+        long long totalDocs = 0;
+        vector<long long> documentFrequency(words.size(), 0);
+        for (auto &reply : replies)
+        {
+            for (size_t i = 0; i < reply.size(); i++)
+            {
+                if (i == 0)
+                    totalDocs += atoll(reply[i].c_str() + 2);
+                else if (i <= words.size())
+                    documentFrequency[i - 1] += atoll(reply[i].c_str() + 3);
+            }
+        }
+
+        string request = string(requireAll ? "AND " : "ANY ") + to_string(topK);
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            double idf = log(1.0 + static_cast<double>(totalDocs) / max(1LL, documentFrequency[i]));
+            char weight[32];
+            snprintf(weight, sizeof(weight), "%.6f", idf);
+            request += " " + words[i] + " " + weight;
+        }
+
+        if (!scatterGather(request, replies, latencyMicros))
+            return false;
+        for (size_t i = 0; i < latencyMicros.size(); i++)
+        {
+            latencyMicros[i] += statsLatency[i];
+        }
+
+        // Shards own disjoint documents, so merging is a sort of the union
+        for (auto &reply : replies)
+        {
+            for (auto &line : reply)
+            {
+                size_t tab = line.find('\t');
+                if (tab != string::npos)
+                {
+                    hits.push_back({atof(line.substr(0, tab).c_str()), line.substr(tab + 1)});
+                }
+            }
+        }
+        sort(hits.begin(), hits.end(), [](const ShardHit &a, const ShardHit &b)
+             { return a.score > b.score; });
+        if (topK > 0 && hits.size() > static_cast<size_t>(topK))
+        {
+            hits.resize(topK);
+        }
+        return !hits.empty();
+    }
+};
+
+// Time a lookup function over every vocabulary word; returns ns per lookup
+template <typename Lookup>
+double benchmarkLookups(const vector<string> &words, int rounds, Lookup lookup)
+{
+    size_t hits = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (const auto &word : words)
+        {
+            hits += lookup(word.c_str()) != nullptr;
+        }
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    if (hits != words.size() * rounds)
+    {
+        cerr << "Benchmark lookup mismatch: " << hits << " hits\n";
+    }
+    return static_cast<double>(elapsed) / max<size_t>(1, words.size() * rounds);
+}
+
+const int PACKED_LAYOUT_BLOCK_DEPTH = 2; // Levels per block in the hot layout
+const int CACHE_SIM_LINE_BYTES = 64;
+const int CACHE_SIM_LINES = 512; // 32 KB, a typical L1 data cache
+
+// Fully associative LRU cache model, used to compare how many distinct cache
+// lines different trie layouts touch for the same lookups
+class CacheSimulator
+{
+private:
+    list<uintptr_t> lru; // Most recently used first
+    unordered_map<uintptr_t, list<uintptr_t>::iterator> resident;
+    size_t capacity;
+    size_t missCount = 0;
+
+public:
+    explicit CacheSimulator(size_t lines) : capacity(lines) {}
+
+    void touch(const void *address)
+    {
+        uintptr_t line = reinterpret_cast<uintptr_t>(address) / CACHE_SIM_LINE_BYTES;
+        auto found = resident.find(line);
+        if (found != resident.end())
+        {
+            lru.splice(lru.begin(), lru, found->second);
+            return;
+        }
+
+        missCount++;
+        lru.push_front(line);
+        resident[line] = lru.begin();
+        if (lru.size() > capacity)
+        {
+            resident.erase(lru.back());
+            lru.pop_back();
+        }
+    }
+
+    size_t misses() const
+    {
+        return missCount;
+    }
+};
+
+// Lookups drawn in proportion to term frequency, so hot terms dominate as
+// they would in real query traffic
+vector<string> frequencyWeightedWorkload(Trie &trie, const vector<string> &words, size_t lookups)
+{
+    vector<double> weights;
+    for (const auto &word : words)
+    {
+        TrieNode *node = trie.findNodePointers(word.c_str());
+        weights.push_back(max(node ? static_cast<double>(node->termFrequency) : 0.0, 1.0));
+    }
+
+    mt19937 gen(42); // Fixed seed so runs are comparable
+    discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    vector<string> workload;
+    for (size_t i = 0; i < lookups; i++)
+        workload.push_back(words[pick(gen)]);
+    return workload;
+}
+
+// Simulated cache misses per lookup for a traced lookup function
+template <typename Trace>
+double simulatedMissesPerLookup(const vector<string> &workload, Trace trace)
+{
+    CacheSimulator cache(CACHE_SIM_LINES);
+    vector<const void *> addresses;
+    for (const auto &word : workload)
+    {
+        addresses.clear();
+        trace(word.c_str(), addresses);
+        for (const void *address : addresses)
+            cache.touch(address);
+    }
+    return static_cast<double>(cache.misses()) / max<size_t>(1, workload.size());
+}
+
+// Encode every term's postings with CompressedPostings and report size and
+// decode/intersection speed against plain 32-bit arrays
+void benchmarkCompressedPostings(Trie &trie)
+{
+    vector<string> words;
+    trie.getVocabulary(words);
+    if (words.empty())
+    {
+        cout << "The index is empty.\n";
+        return;
+    }
+
+    vector<uint8_t> encoded;
+    vector<size_t> offsets;
+    vector<vector<uint32_t>> plainDocs;
+    size_t postingCount = 0, positionCount = 0, docBytes = 0;
+    vector<FileInfo> scratch, sorted;
+    for (const auto &word : words)
+    {
+        TrieNode *node = trie.findNodePointers(word.c_str());
+        sorted = trie.postingsOf(node, scratch);
+        sort(sorted.begin(), sorted.end(), [](const FileInfo &a, const FileInfo &b)
+             { return a.fileId < b.fileId; });
+        offsets.push_back(encoded.size());
+        CompressedPostings::encode(sorted, encoded);
+
+        vector<uint32_t> docs;
+        for (const FileInfo &info : sorted)
+        {
+            docs.push_back(info.fileId);
+            positionCount += info.positionCount;
+        }
+        postingCount += docs.size();
+        plainDocs.push_back(docs);
+    }
+    auto readerAt = [&](size_t term)
+    {
+        return CompressedPostings::Reader(encoded.data() + offsets[term], encoded.data() + encoded.size());
+    };
+    size_t headerBytes = 0;
+    for (size_t term = 0; term < words.size(); term++)
+    {
+        CompressedPostings::Reader reader = readerAt(term);
+        docBytes += reader.docBytes();
+        headerBytes += (CompressedPostings::HEADER_WORDS + 2 * reader.blockCount()) * sizeof(uint32_t);
+    }
+    size_t positionBytes = encoded.size() - docBytes;
+
+#ifdef __SSSE3__
+    const char *decoder = "SSSE3 shuffle";
+#else
+    const char *decoder = "scalar (build with -mssse3 for the SIMD decoder)";
+#endif
+    cout << fixed << setprecision(2);
+    cout << words.size() << " terms, " << postingCount << " postings, " << positionCount << " positions; decoder: "
+         << decoder << "\n";
+    cout << "Doc entries:     " << (docBytes - headerBytes) / static_cast<double>(max<size_t>(1, postingCount))
+         << " bytes/posting for doc id, freq and position count (raw 12.00), plus " << headerBytes / static_cast<double>(words.size())
+         << " bytes/term of header and skip entries\n";
+    cout << "Positions:       " << positionBytes / static_cast<double>(max<size_t>(1, positionCount))
+         << " bytes/position (raw 4.00)\n";
+
+    // Decode throughput over the whole index
+    const int rounds = max<int>(1, 20000000 / max<size_t>(1, postingCount));
+    vector<uint32_t> docs;
+    size_t checksum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (size_t term = 0; term < words.size(); term++)
+        {
+            readerAt(term).decodeDocs(docs);
+            checksum += docs.size();
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Doc id decode:   " << postingCount * rounds / max(seconds, 1e-9) / 1e6 << " M postings/s"
+         << (checksum == postingCount * rounds ? "" : " (WARNING: decoded counts differ!)") << "\n";
+
+    // AND of pairs among the terms with the longest lists
+    vector<size_t> byLength(words.size());
+    for (size_t i = 0; i < byLength.size(); i++)
+        byLength[i] = i;
+    size_t top = min<size_t>(200, byLength.size());
+    partial_sort(byLength.begin(), byLength.begin() + top, byLength.end(), [&](size_t a, size_t b)
+                 { return plainDocs[a].size() > plainDocs[b].size(); });
+
+    mt19937 gen(42);
+    vector<pair<size_t, size_t>> pairs;
+    for (int i = 0; i < 2000; i++)
+        pairs.push_back({byLength[gen() % top], byLength[gen() % top]});
+
+    vector<uint32_t> out;
+    size_t compressedHits = 0, plainHits = 0;
+    start = chrono::steady_clock::now();
+    for (const auto &pair : pairs)
+    {
+        CompressedPostings::intersect({readerAt(pair.first), readerAt(pair.second)}, out);
+        compressedHits += out.size();
+    }
+    double compressedMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (const auto &pair : pairs)
+    {
+        out.clear();
+        const vector<uint32_t> &a = plainDocs[pair.first], &b = plainDocs[pair.second];
+        set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(out));
+        plainHits += out.size();
+    }
+    double plainMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+    cout << "AND of " << pairs.size() << " frequent term pairs: compressed " << compressedMicros / pairs.size()
+         << " us/query, uncompressed arrays " << plainMicros / pairs.size() << " us/query"
+         << (compressedHits == plainHits ? "" : " (WARNING: results differ!)") << "\n";
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+}
+
+void printDeletionIndexStats(const DeletionIndex &index, long long buildMicros)
+{
+    cout << "Deletion index built in " << buildMicros << " microseconds (distance "
+         << index.getMaxDistance() << ", prefix " << index.getPrefixLength() << ")\n";
+    cout << "  " << index.termCount() << " terms, " << index.keyCount() << " delete keys, "
+         << index.postingCount() << " entries, ~" << index.memoryBytes() / 1024 << " KB\n";
+}
+
+// The words of a query that can name index terms, space separated.
+// Operators (OR, -word), mode keywords, counts and wildcard patterns are
+// left out so they never reach the query log or autocomplete ranking.
+string queryTerms(const string &query)
+{
+    string terms;
+    istringstream words(query);
+    string word;
+    while (words >> word)
+    {
+        if (word == "OR" || word[0] == '-' || word.find_first_of("?*") != string::npos)
+            continue;
+        bool term = true;
+        for (char ch : word)
+            term = term && TRIE_ALPHABET::keyChar(ch) != '\0';
+        if (!term)
+            continue;
+        if (!terms.empty())
+            terms += ' ';
+        terms += word;
+    }
+    return terms;
+}
+
+// Tell the user a query stopped early and its results are partial
+void reportTruncation(const QueryBudget &budget)
+{
+    if (budget.truncated())
+    {
+        cout << "(Results truncated: query budget exhausted after " << budget.visited() << " visits)\n";
+    }
+}
+
+// Text forms of typed results, for the menu and the exporters. Queries
+// only hand back SearchHits; paths and counts become text here, for the
+// results actually shown or written.
+void formatWordDetails(Trie &trie, const char *word, const SearchResults &details, vector<string> &lines)
+{
+    lines.clear();
+    if (!details.term)
+        return;
+    lines.push_back(string("Word: ") + word + " [stemmed: " + details.term + "]");
+    lines.push_back("Total occurrences: " + to_string(details.totalOccurrences));
+    lines.push_back("Occurrences by file:");
+    for (size_t i = 0; i < details.hits.size() && lines.size() < (size_t)MAX_RESULTS; i++)
+    {
+        const SearchHit &hit = details.hits[i];
+        lines.push_back(string("  - ") + trie.getFilename(hit.docId) + ": " + to_string(hit.frequency) + " times");
+    }
+}
+
+// One line per hit: the document path, plus the distance between the
+// matched positions when the hit has a span
+void formatDocumentHits(Trie &trie, const SearchResults &results, vector<string> &lines)
+{
+    lines.clear();
+    for (const SearchHit &hit : results.hits)
+    {
+        string line = trie.getFilename(hit.docId);
+        if (hit.firstPosition >= 0 && !hit.term)
+            line += " (distance: " + to_string(hit.lastPosition - hit.firstPosition) + ")";
+        lines.push_back(line);
+    }
+}
+
+// One line per term of term-matching results (wildcard, suffix, infix):
+// "term: path, path, ...". Each term's hits are adjacent.
+void formatTermHits(Trie &trie, const SearchResults &results, vector<string> &lines)
+{
+    lines.clear();
+    const char *lastTerm = nullptr;
+    for (const SearchHit &hit : results.hits)
+    {
+        if (hit.term != lastTerm)
+        {
+            lines.push_back(string(hit.term) + ": " + trie.getFilename(hit.docId));
+            lastTerm = hit.term;
+        }
+        else
+        {
+            lines.back() += string(", ") + trie.getFilename(hit.docId);
+        }
+    }
+}
+
+// Maintenance operations on the built index
+void runIndexTools(Trie &trie)
+{
+    while (true)
+    {
+        cout << "\nIndex Tools (" << TRIE_ALPHABET::NAME << " alphabet, " << TRIE_ALPHABET::SIZE
+             << " symbols, " << sizeof(TrieNode) << "-byte nodes)\n";
+        cout << "1. Build double-array trie\n";
+        cout << "2. Save double-array trie to disk\n";
+        cout << "3. Benchmark exact lookups\n";
+        cout << "4. Build FST term dictionary\n";
+        cout << "5. Query FST (exact/prefix/fuzzy)\n";
+        cout << "6. Bloom filter statistics\n";
+        cout << "7. Set Bloom filter false-positive rate\n";
+        cout << "8. Benchmark edit distance\n";
+        cout << "9. Build spelling deletion index\n";
+        cout << "10. Relayout trie for cache locality\n";
+        cout << "11. Move postings to disk (memory-mapped)\n";
+        cout << "12. Benchmark compressed postings\n";
+        cout << "13. Remove a file from search results\n";
+        cout << "14. Segment statistics\n";
+        cout << "15. Checkpoint index (snapshot and empty the write-ahead log)\n";
+        cout << "0. Back\n";
+        cout << "Choice: ";
+
+        int choice;
+        if (!(cin >> choice) || choice == 0)
+        {
+            cin.clear();
+            return;
+        }
+
+        switch (choice)
+        {
+        case 1:
+        {
+            auto start = chrono::steady_clock::now();
+            trie.buildDoubleArray();
+            auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+            const Trie::DoubleArray &da = trie.getDoubleArray();
+            cout << "Double-array built in " << micros << " microseconds: "
+                 << da.usedSlots() << " states in " << da.slotCount() << " slots ("
+                 << fixed << setprecision(1) << 100.0 * da.usedSlots() / max<size_t>(1, da.slotCount())
+                 << "% full), " << da.arrayBytes() << " bytes\n";
+            cout.unsetf(ios::fixed);
+            cout << setprecision(6);
+            break;
+        }
+
+        case 2:
+        {
+            if (!trie.getDoubleArray().built())
+            {
+                cout << "Build the double-array trie first.\n";
+                break;
+            }
+            string filename;
+            cout << "Enter filename for the double-array image: ";
+            cin >> filename;
+            if (trie.getDoubleArray().save(filename.c_str()))
+                cout << "Saved " << trie.getDoubleArray().arrayBytes() << " bytes to " << filename << "\n";
+            else
+                cout << "Failed to write " << filename << "\n";
+            break;
+        }
+
+        case 3:
+        {
+            vector<string> words;
+            trie.getVocabulary(words);
+            if (words.empty())
+            {
+                cout << "The index is empty.\n";
+                break;
+            }
+            const int rounds = max(1, 1000000 / static_cast<int>(words.size()));
+
+            double pointerNs = benchmarkLookups(words, rounds, [&](const char *w)
+                                                { return trie.findNodePointers(w); });
+            cout << "Pointer trie:  " << pointerNs << " ns/lookup\n";
+            if (trie.getDoubleArray().built())
+            {
+                double arrayNs = benchmarkLookups(words, rounds, [&](const char *w)
+                                                  { return trie.findNode(w); });
+                cout << "Double-array:  " << arrayNs << " ns/lookup\n";
+            }
+            else
+            {
+                cout << "Build the double-array trie to compare.\n";
+            }
+            if (trie.getPackedLayout().built())
+            {
+                double packedNs = benchmarkLookups(words, rounds, [&](const char *w)
+                                                   { return trie.findNode(w); });
+                cout << "Packed layout: " << packedNs << " ns/lookup\n";
+            }
+
+            // Compare layouts on a frequency-weighted workload, both timed and
+            // through a cache model (independent of this machine's caches)
+            vector<string> workload = frequencyWeightedWorkload(trie, words, 200000);
+            Trie::PackedLayout breadthFirst, hotBlocked;
+            trie.buildPackedLayoutCopy(breadthFirst, 0);
+            trie.buildPackedLayoutCopy(hotBlocked, PACKED_LAYOUT_BLOCK_DEPTH);
+
+            double pointerMisses = simulatedMissesPerLookup(workload, [&](const char *w, vector<const void *> &trace)
+                                                            { trie.tracePointerLookup(w, trace); });
+            double bfsMisses = simulatedMissesPerLookup(workload, [&](const char *w, vector<const void *> &trace)
+                                                        { breadthFirst.walk(w, &trace); });
+            double hotMisses = simulatedMissesPerLookup(workload, [&](const char *w, vector<const void *> &trace)
+                                                        { hotBlocked.walk(w, &trace); });
+            double pointerWeightedNs = benchmarkLookups(workload, 1, [&](const char *w)
+                                                        { return trie.findNodePointers(w); });
+            double bfsWeightedNs = benchmarkLookups(workload, 1, [&](const char *w)
+                                                    { return breadthFirst.findTerm(w); });
+            double hotWeightedNs = benchmarkLookups(workload, 1, [&](const char *w)
+                                                    { return hotBlocked.findTerm(w); });
+
+            cout << "Frequency-weighted workload (" << workload.size() << " lookups, simulated "
+                 << CACHE_SIM_LINES * CACHE_SIM_LINE_BYTES / 1024 << " KB LRU cache):\n";
+            cout << fixed << setprecision(2);
+            cout << "  Pointer trie:     " << pointerMisses << " misses/lookup, " << pointerWeightedNs << " ns/lookup\n";
+            cout << "  Breadth-first:    " << bfsMisses << " misses/lookup, " << bfsWeightedNs << " ns/lookup ("
+                 << 100.0 * (1 - bfsMisses / max(pointerMisses, 1e-9)) << "% fewer misses)\n";
+            cout << "  Hot-path blocked: " << hotMisses << " misses/lookup, " << hotWeightedNs << " ns/lookup ("
+                 << 100.0 * (1 - hotMisses / max(pointerMisses, 1e-9)) << "% fewer misses)\n";
+            cout.unsetf(ios::fixed);
+            cout << setprecision(6);
+            break;
+        }
+
+        case 4:
+        {
+            auto start = chrono::steady_clock::now();
+            trie.buildFst();
+            auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+            const FstDictionary &fst = trie.getFst();
+            size_t terms = max<size_t>(1, fst.size());
+            size_t trieBytes = trie.getNodeCount() * sizeof(TrieNode);
+            cout << "FST built in " << micros << " microseconds: " << fst.size() << " terms, "
+                 << fst.stateCount() << " states, " << fst.arcCount() << " arcs\n";
+            cout << "FST:       " << fst.memoryBytes() << " bytes (" << fst.memoryBytes() / static_cast<double>(terms)
+                 << " bytes/term)\n";
+            cout << "TrieNodes: " << trieBytes << " bytes (" << trieBytes / static_cast<double>(terms)
+                 << " bytes/term, " << sizeof(TrieNode) << " bytes/node)\n";
+            break;
+        }
+
+        case 5:
+        {
+            const FstDictionary &fst = trie.getFst();
+            if (!fst.built())
+            {
+                cout << "Build the FST term dictionary first.\n";
+                break;
+            }
+
+            string mode, term;
+            cout << "Lookup type (exact/prefix/fuzzy) and term: ";
+            cin >> mode >> term;
+            transform(term.begin(), term.end(), term.begin(), ::tolower);
+
+            vector<pair<string, uint64_t>> matches;
+            uint64_t offset;
+            if (mode == "exact")
+            {
+                if (fst.lookup(term.c_str(), offset))
+                    matches.push_back({term, offset});
+            }
+            else if (mode == "prefix")
+            {
+                fst.prefixLookup(term.c_str(), MAX_RESULTS, matches);
+            }
+            else
+            {
+                fst.fuzzyLookup(term.c_str(), MAX_EDIT_DISTANCE, matches);
+            }
+
+            if (matches.empty())
+            {
+                cout << "No matching terms.\n";
+                break;
+            }
+            for (size_t i = 0; i < matches.size(); i++)
+            {
+                TrieNode *node = trie.fstPostingsAt(matches[i].second);
+                cout << (i + 1) << ". " << matches[i].first << " (postings offset " << matches[i].second
+                     << ", " << (node ? node->fileInfoCount : 0) << " files)\n";
+            }
+            break;
+        }
+
+        case 6:
+            trie.printBloomStats();
+            break;
+
+        case 7:
+        {
+            double rate;
+            cout << "Target false-positive rate (e.g. 0.01): ";
+            if (!(cin >> rate) || rate <= 0 || rate >= 1)
+            {
+                cin.clear();
+                cout << "Rate must be between 0 and 1.\n";
+                break;
+            }
+            trie.setBloomFalsePositiveRate(rate);
+            trie.printBloomStats();
+            break;
+        }
+
+        case 8:
+        {
+            string query;
+            cout << "Enter query word: ";
+            cin >> query;
+            if (query.size() >= static_cast<size_t>(MAX_WORD_LENGTH))
+            {
+                cout << "Query must be shorter than " << MAX_WORD_LENGTH << " characters.\n";
+                break;
+            }
+
+            vector<string> words;
+            trie.getVocabulary(words);
+            if (words.empty())
+            {
+                cout << "The index is empty.\n";
+                break;
+            }
+            const int rounds = max(1, 200000 / static_cast<int>(words.size()));
+
+            vector<int> scalar(words.size()), batched;
+            auto start = chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++)
+            {
+                for (size_t i = 0; i < words.size(); i++)
+                    scalar[i] = trie.editDistanceScalar(query.c_str(), words[i].c_str());
+            }
+            double scalarNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() /
+                              static_cast<double>(words.size() * rounds);
+
+            start = chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++)
+            {
+                trie.editDistanceBatch(query.c_str(), words, batched);
+            }
+            double batchedNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() /
+                               static_cast<double>(words.size() * rounds);
 
-        vector<thread> threads;
-        for (unsigned int i = 0; i < numThreads; i++)
-        {
-            threads.push_back(thread([&files, &trie, i, numThreads]()
-                                     {
-                for (size_t j = i; j < files.size(); j += numThreads) {
-                    processFile(files[j], trie);
-                } }));
+            cout << "Scored " << words.size() << " candidates x " << rounds << " rounds\n";
+            cout << "Scalar DP:     " << scalarNs << " ns/candidate\n";
+            cout << "Bit-parallel:  " << batchedNs << " ns/candidate (" << scalarNs / max(batchedNs, 1e-9) << "x)\n";
+            cout << (scalar == batched ? "Results match.\n" : "WARNING: results differ!\n");
+            break;
         }
 
-        for (auto &t : threads)
+        case 9:
         {
-            t.join();
+            int prefixLength;
+            cout << "Prefix length (smaller uses less memory, verifies more candidates): ";
+            if (!(cin >> prefixLength) || prefixLength < 1)
+            {
+                cin.clear();
+                cout << "Prefix length must be at least 1.\n";
+                break;
+            }
+            long long micros = trie.enableDeletionIndex(MAX_EDIT_DISTANCE, prefixLength);
+            printDeletionIndexStats(trie.getDeletionIndex(), micros);
+            break;
         }
-    }
 
-    // String utility for unicode handling with locale
-    string toUpperCase(const string &input)
-    {
-        string result = input;
-        locale loc("en_US.UTF-8");
-        for (auto &c : result)
+        case 10:
         {
-            c = toupper(c, loc);
+            string order;
+            cout << "Layout order (bfs/hot): ";
+            cin >> order;
+            int blockDepth = order == "bfs" ? 0 : PACKED_LAYOUT_BLOCK_DEPTH;
+
+            auto start = chrono::steady_clock::now();
+            trie.buildPackedLayout(blockDepth);
+            auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+            const Trie::PackedLayout &packed = trie.getPackedLayout();
+            cout << "Packed " << (blockDepth == 0 ? "breadth-first" : "hot-path blocked") << " layout built in "
+                 << micros << " microseconds: " << packed.nodeCount() << " nodes, " << packed.arrayBytes()
+                 << " bytes. Lookups now use it until new words are indexed.\n";
+            break;
         }
-        return result;
-    }
 
-    // Smart pointer example for memory management
-    shared_ptr<vector<string>> createWordVector(const string &text)
-    {
-        auto words = make_shared<vector<string>>();
-        istringstream iss(text);
-        string word;
-        while (iss >> word)
+        case 11:
         {
-            if (isValidWord(word))
+            size_t residentBefore = trie.residentPostingsBytes();
+            auto start = chrono::steady_clock::now();
+            long long terms = trie.spillPostings(POSTINGS_FILE);
+            auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+            if (terms < 0)
             {
-                words->push_back(word);
+                cout << "Failed to write " << POSTINGS_FILE << "\n";
+                break;
             }
-        }
-        return words;
-    }
-}
 
-// Menu system
-void displayMenu()
-{
-    cout << "\nMini Search Engine\n";
-    cout << "1. Search Word\n";
-    cout << "2. Partial Search\n";
-    cout << "3. Autocomplete\n";
-    cout << "4. Show Word Details\n";
-    cout << "5. Advanced Search\n";
-    cout << "6. Spell Check\n";
-    cout << "7. Proximity Search\n";
-    cout << "8. Search History\n";
-    cout << "9. Export Results\n";
-    cout << "10. Exit\n";
-    cout << "11. Background Auto-Indexing\n";
-    cout << "Choice: ";
-}
+            const PostingsFile &postings = trie.getPostingsFile();
+            cout << "Wrote postings for " << terms << " terms to " << POSTINGS_FILE << " (" << postings.bytes()
+                 << " bytes) in " << micros << " microseconds\n";
+            cout << "Resident postings: " << residentBefore / 1024 << " KB before, "
+                 << trie.residentPostingsBytes() / 1024 << " KB after; "
+                 << postings.residentBytes() / 1024 << " KB of the mapping currently paged in\n";
+            break;
+        }
 
-// Background indexing thread function
-void backgroundIndexing(Trie &trie, const string &directory, atomic<bool> &running)
-{
-    cout << "Background indexing started...\n";
+        case 12:
+            benchmarkCompressedPostings(trie);
+            break;
 
-    while (running)
-    {
-        // Get all files in directory
-        vector<string> files = Utils::getFilesInDirectory(directory);
+        case 13:
+        {
+            for (int i = 0; i < trie.getFileCount(); i++)
+            {
+                cout << (i + 1) << ". " << trie.getFilename(i) << (trie.isDocumentDeleted(i) ? " (removed)" : "") << "\n";
+            }
+            int fileNumber;
+            cout << "File number to remove: ";
+            if (!(cin >> fileNumber) || fileNumber < 1 || fileNumber > trie.getFileCount())
+            {
+                cin.clear();
+                cout << "No such file.\n";
+                break;
+            }
+            trie.markDocumentDeleted(fileNumber - 1);
+            DocSet deleted = trie.getDeletedDocuments();
+            cout << "Removed " << trie.getFilename(fileNumber - 1) << " from results. " << deleted.cardinality()
+                 << " files removed (" << deleted.memoryBytes() << " bytes of tombstones).\n";
+            break;
+        }
 
-        // Process any new files
-        for (const auto &file : files)
+        case 14:
         {
-            // Check if file is already indexed (this would need further implementation)
-            cout << "Background indexing: " << file << "\n";
-            processFile(file, trie);
+            Trie::SegmentStats stats = trie.getSegmentStats();
+            if (stats.budget == 0 && stats.segments.empty())
+            {
+                cout << "No memory budget set; all postings are kept in memory.\n";
+                break;
+            }
+            cout << "Memory budget " << stats.budget / 1024 << " KB, live postings " << stats.liveBytes / 1024
+                 << " KB; " << stats.flushes << " flushes, " << stats.merges << " merges\n";
+
+            map<int, pair<int, size_t>> tiers; // tier -> (segments, bytes)
+            for (const auto &segment : stats.segments)
+            {
+                tiers[segment.first].first++;
+                tiers[segment.first].second += segment.second;
+            }
+            cout << stats.segments.size() << " segments in " << SEGMENT_DIRECTORY << "/\n";
+            for (const auto &tier : tiers)
+            {
+                cout << "  Tier " << tier.first << ": " << tier.second.first << " segments, "
+                     << tier.second.second / 1024 << " KB\n";
+            }
+            break;
         }
 
-        // Wait for 30 seconds before checking again
-        for (int i = 0; i < 30 && running; i++)
+        case 15:
         {
-            this_thread::sleep_for(chrono::seconds(1));
+            long long logged = trie.loggedRecords();
+            auto start = chrono::steady_clock::now();
+            if (!trie.checkpoint(SNAPSHOT_FILE))
+            {
+                cout << "Failed to write " << SNAPSHOT_FILE << "\n";
+                break;
+            }
+            auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+            error_code error;
+            cout << "Wrote " << SNAPSHOT_FILE << " (" << fs::file_size(SNAPSHOT_FILE, error) / 1024 << " KB) in "
+                 << micros << " microseconds; " << logged << " log records folded in.\n";
+            break;
         }
-    }
 
-    cout << "Background indexing stopped.\n";
+        default:
+            cout << "Invalid choice.\n";
+        }
+    }
 }
 
 int main()
 {
+    WriteAheadLog writeAheadLog; // Outlives trie, which logs into it
     Trie trie;
     SearchHistory history;
+    int loggedQueries = history.open(QUERY_LOG_FILE);
     string filename;
     vector<string> indexedFiles;       // Use vector instead of arrays
+    string crawlDirectory;             // Set when indexing a directory tree
+    vector<string> includeGlobs, excludeGlobs;
     unordered_set<string> uniqueFiles; // Track unique files
     atomic<bool> backgroundRunning(false);
     thread backgroundThread;
+    ShardCoordinator shardCoordinator;
 
     cout << "==== Mini Search Engine ====\n";
 
+    // Offer to pick up where the last session left off
+    error_code error;
+    bool recover = false;
+    if (fs::exists(SNAPSHOT_FILE) || (fs::exists(WAL_FILE) && fs::file_size(WAL_FILE, error) > 0))
+    {
+        cout << "Recover the index saved by the last session? (y/n): ";
+        char recoverChoice;
+        cin >> recoverChoice;
+        recover = tolower(recoverChoice) == 'y';
+        if (!recover)
+        {
+            fs::remove(SNAPSHOT_FILE, error);
+            fs::remove(WAL_FILE, error);
+        }
+    }
+
     // Option to index all files in a directory
     cout << "Would you like to: \n";
     cout << "1. Enter specific files to index\n";
@@ -1210,7 +8366,7 @@ int main()
     if (indexChoice == 1)
     {
         cout << "Enter files to index (space separated): ";
-        while (cin >> filename && indexedFiles.size() < MAX_FILES)
+        while (cin >> filename)
         {
             // Use unordered_set to avoid duplicates
             if (uniqueFiles.find(filename) == uniqueFiles.end())
@@ -1225,47 +8381,203 @@ int main()
     }
     else
     {
-        string directory;
         cout << "Enter directory path: ";
-        cin >> directory;
+        cin >> crawlDirectory;
 
-        // Use filesystem library to get all files
-        indexedFiles = Utils::getFilesInDirectory(directory);
-
-        // Limit to MAX_FILES
-        if (indexedFiles.size() > MAX_FILES)
+        // Globs on file and directory names; a leading '!' excludes
+        cout << "File name patterns (e.g. *.txt !*.log, * for all): ";
+        cin.ignore(1000, '\n');
+        string patterns, pattern;
+        getline(cin, patterns);
+        istringstream patternStream(patterns);
+        while (patternStream >> pattern)
         {
-            cout << "Found " << indexedFiles.size() << " files, but only the first "
-                 << MAX_FILES << " will be indexed.\n";
-            indexedFiles.resize(MAX_FILES);
+            if (pattern[0] == '!')
+                excludeGlobs.push_back(pattern.substr(1));
+            else if (pattern != "*")
+                includeGlobs.push_back(pattern);
         }
     }
 
+    // Optionally maintain a spelling deletion index while indexing
+    cout << "Build spelling deletion index for fast spell check? (y/n): ";
+    char spellChoice;
+    cin >> spellChoice;
+    if (tolower(spellChoice) == 'y')
+    {
+        trie.enableDeletionIndex(MAX_EDIT_DISTANCE, DELETION_INDEX_PREFIX_LENGTH);
+    }
+
+    cout << "Build trigram index for substring search? (y/n): ";
+    char trigramChoice;
+    cin >> trigramChoice;
+    if (tolower(trigramChoice) == 'y')
+    {
+        trie.enableTrigramIndex();
+    }
+
+    // Bound the memory held by postings; the rest goes to on-disk segments
+    cout << "Memory budget for in-memory postings in MB (0 = unlimited): ";
+    size_t budgetMegabytes = 0;
+    if (!(cin >> budgetMegabytes))
+    {
+        cin.clear();
+        budgetMegabytes = 0;
+    }
+    if (budgetMegabytes > 0 && !trie.setMemoryBudget(budgetMegabytes * 1024 * 1024))
+    {
+        cerr << "Could not prepare " << SEGMENT_DIRECTORY << "/; keeping all postings in memory.\n";
+    }
+
+    long long loggedRecords = 0;
+    if (recover)
+    {
+        auto start = chrono::steady_clock::now();
+        RecoveryReport report = recoverIndex(trie);
+        auto millis = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        loggedRecords = max(report.logRecords, 0LL);
+        cout << "Recovered " << max(report.snapshotDocuments, 0LL) << " files from " << SNAPSHOT_FILE << " and replayed "
+             << loggedRecords << " log records (" << report.reindexed << " files re-indexed, " << report.removed
+             << " removed) in " << millis << " ms.\n";
+    }
+    if (writeAheadLog.open(WAL_FILE, loggedRecords))
+    {
+        trie.attachWriteAheadLog(&writeAheadLog);
+    }
+    else
+    {
+        cerr << "Could not open " << WAL_FILE << "; indexing will not be crash safe.\n";
+    }
+
     // Show processing message with timestamp
     cout << "Indexing files... " << Utils::getTimestamp() << "\n";
 
     // Option to use multithreaded processing
-    cout << "Use multithreaded processing? (y/n): ";
+    cout << "Use multithreaded processing? (y/n, p for pipelined): ";
     char multiChoice;
     cin >> multiChoice;
 
+    // A directory is crawled while it is being indexed: files stream from
+    // the crawler straight to the indexer. Files already in the recovered
+    // index are not indexed again.
+    DirectoryCrawler crawler;
+    FileSource requestedFiles = fileListSource(indexedFiles);
+    if (!crawlDirectory.empty())
+    {
+        crawler.start(crawlDirectory, includeGlobs, excludeGlobs, max(1u, thread::hardware_concurrency()));
+        requestedFiles = [&crawler](string &path)
+        {
+            return crawler.next(path);
+        };
+    }
+    mutex sourceMutex;
+    size_t processedFiles = 0, skippedFiles = 0;
+    FileSource nextFile = [&](string &path)
+    {
+        while (requestedFiles(path))
+        {
+            bool known = trie.findFileId(path.c_str()) >= 0;
+            lock_guard<mutex> lock(sourceMutex);
+            if (!crawlDirectory.empty())
+                indexedFiles.push_back(path);
+            if (known)
+            {
+                skippedFiles++;
+                continue;
+            }
+            processedFiles++;
+            return true;
+        }
+        return false;
+    };
+
     if (tolower(multiChoice) == 'y')
     {
         // Use multithreaded processing
-        Utils::processFilesParallel(indexedFiles, trie);
+        Utils::processFilesParallel(nextFile, trie);
+    }
+    else if (tolower(multiChoice) == 'p')
+    {
+        // Overlap reading, tokenizing and inserting on separate threads
+        processFilesPipelined(nextFile, trie);
     }
     else
     {
         // Use regular processing
-        for (const auto &file : indexedFiles)
+        string file;
+        while (nextFile(file))
         {
             cout << "Processing: " << file << "...\n";
             processFile(file, trie);
         }
     }
 
-    cout << "Indexing complete! " << indexedFiles.size() << " files processed. "
+    if (!crawlDirectory.empty())
+    {
+        crawler.wait();
+        crawler.report();
+    }
+    if (skippedFiles > 0)
+    {
+        cout << "Skipped " << skippedFiles << " files that were already indexed.\n";
+    }
+
+    trie.refreshAffixIndex();
+
+    // The terms of each search go to the query log and count towards
+    // autocomplete ranking
+    auto recordQuery = [&](const string &query)
+    {
+        string terms = queryTerms(query);
+        if (terms.empty())
+            return;
+        history.addQuery(terms.c_str());
+        trie.recordQueryTerms(terms.c_str());
+    };
+
+    // Result buffers reused by every query below
+    SearchResults queryResults;
+    vector<string> resultLines;
+
+    cout << "Indexing complete! " << processedFiles << " files processed. "
          << Utils::getTimestamp() << "\n";
+    if (trie.getDeletionIndex().enabled())
+    {
+        const DeletionIndex &deletionIndex = trie.getDeletionIndex();
+        cout << "Spelling deletion index: " << deletionIndex.keyCount() << " delete keys, ~"
+             << deletionIndex.memoryBytes() / 1024 << " KB\n";
+    }
+    if (writeAheadLog.isOpen())
+    {
+        cout << "Write-ahead log: " << writeAheadLog.recordCount() << " records, committed with "
+             << writeAheadLog.syncCount() << " syncs\n";
+    }
+
+    // Replay the query log: rank previously searched terms and warm the
+    // postings and cached details of the hottest ones
+    if (loggedQueries > 0)
+    {
+        for (const auto &entry : history.counts)
+        {
+            trie.recordQueryTerms(queryTerms(entry.first).c_str(), entry.second);
+        }
+
+        int warmed = 0;
+        for (const auto &entry : history.hottest(HOT_QUERY_WARM_COUNT))
+        {
+            istringstream words(entry.first);
+            string word;
+            while (words >> word)
+            {
+                if (Utils::isValidWord(word) && trie.warmWord(word.c_str()))
+                {
+                    warmed++;
+                }
+            }
+        }
+        cout << "Replayed " << loggedQueries << " logged queries (" << history.counts.size()
+             << " distinct), warmed " << warmed << " hot terms.\n";
+    }
 
     while (true)
     {
@@ -1282,6 +8594,8 @@ int main()
 
         if (choice == 10)
         {
+            shardCoordinator.stop();
+
             // Stop background thread if running
             if (backgroundRunning)
             {
@@ -1291,6 +8605,13 @@ int main()
                     backgroundThread.join();
                 }
             }
+
+            // The next session recovers from this snapshot instead of the log
+            cout << "Saving index snapshot...\n";
+            if (!trie.checkpoint(SNAPSHOT_FILE))
+            {
+                cerr << "Could not write " << SNAPSHOT_FILE << "; the write-ahead log is kept.\n";
+            }
             break;
         }
 
@@ -1309,7 +8630,7 @@ int main()
                 break;
             }
 
-            history.addQuery(input.c_str());
+            recordQuery(input);
 
             // Start a timer to measure search performance
             auto startTime = chrono::high_resolution_clock::now();
@@ -1324,13 +8645,13 @@ int main()
                 cout << "Word found! (Search took " << duration.count() << " microseconds)\n";
 
                 // Show basic word details
-                char result[MAX_RESULTS][MAX_WORD_LENGTH];
-                int resultCount = 0;
-                trie.getWordDetails(input.c_str(), result, resultCount);
-                for (int i = 0; i < resultCount && i < 2; i++)
-                { // Just show first two lines
-                    cout << result[i] << endl;
+                QueryBudget budget = QueryBudget::interactive();
+                if (trie.getWordDetails(input.c_str(), queryResults, budget))
+                {
+                    cout << "Word: " << input << " [stemmed: " << queryResults.term << "]\n";
+                    cout << "Total occurrences: " << queryResults.totalOccurrences << endl;
                 }
+                reportTruncation(budget);
             }
             else
             {
@@ -1339,7 +8660,8 @@ int main()
                 // Check for spelling suggestions
                 char spellSuggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
                 int suggestionCount = 0;
-                if (trie.spellCheck(input.c_str(), spellSuggestions, suggestionCount))
+                QueryBudget budget = QueryBudget::interactive();
+                if (trie.spellCheck(input.c_str(), spellSuggestions, suggestionCount, budget))
                 {
                     cout << "Did you mean:\n";
                     for (int i = 0; i < min(3, suggestionCount); i++)
@@ -1347,6 +8669,7 @@ int main()
                         cout << (i + 1) << ". " << spellSuggestions[i] << endl;
                     }
                 }
+                reportTruncation(budget);
                 cout << "Try using autocomplete to find similar words.\n";
             }
         }
@@ -1355,38 +8678,49 @@ int main()
         case 2: // Partial Search
             cout << "Enter partial word to search: ";
             cin >> input;
-            history.addQuery(input.c_str());
+            recordQuery(input);
             {
-                char partialResults[MAX_RESULTS][MAX_WORD_LENGTH];
-                int partialResultCount = 0;
-                if (trie.partialSearch(input.c_str(), partialResults, partialResultCount))
+                // Page through the matches; each page only walks as far as it shows
+                TrieCursor cursor = trie.prefixCursor(input.c_str());
+                QueryBudget budget = QueryBudget::interactive();
+                string_view term;
+                int shown = 0;
+                bool more = trie.nextTerm(cursor, term, budget);
+                while (more)
                 {
-                    cout << "Found " << partialResultCount << " partial matches:\n";
-                    for (int i = 0; i < partialResultCount; i++)
+                    cout << (++shown) << ". " << term << endl;
+                    more = trie.nextTerm(cursor, term, budget);
+                    if (more && shown % PARTIAL_SEARCH_PAGE_SIZE == 0)
                     {
-                        cout << (i + 1) << ". " << partialResults[i] << endl;
-                        if (i >= 9)
-                        { // Limit to 10 results
-                            cout << "... and " << (partialResultCount - 10) << " more matches\n";
+                        string answer;
+                        cout << "Show more matches? (y/n): ";
+                        cin >> answer;
+                        if (answer != "y" && answer != "Y")
                             break;
-                        }
+                        budget = QueryBudget::interactive();
                     }
                 }
-                else
+                if (shown == 0)
                 {
                     cout << "No partial matches found.\n";
                 }
+                else
+                {
+                    cout << "Showed " << shown << " partial matches" << (more ? " (more available)" : "") << ".\n";
+                }
+                reportTruncation(budget);
             }
             break;
 
         case 3: // Autocomplete
             cout << "Enter prefix for autocomplete: ";
             cin >> input;
-            history.addQuery(input.c_str());
+            recordQuery(input);
             {
                 char autocompleteSuggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
                 int suggestionCount = 0;
-                if (trie.autocomplete(input.c_str(), autocompleteSuggestions, suggestionCount))
+                QueryBudget budget = QueryBudget::interactive();
+                if (trie.autocomplete(input.c_str(), autocompleteSuggestions, suggestionCount, budget))
                 {
                     cout << "Autocomplete suggestions:\n";
                     for (int i = 0; i < suggestionCount; i++)
@@ -1403,23 +8737,23 @@ int main()
                 {
                     cout << "No autocomplete suggestions found.\n";
                 }
+                reportTruncation(budget);
             }
             break;
 
         case 4: // Word Details
             cout << "Enter word to show details: ";
             cin >> input;
-            history.addQuery(input.c_str());
+            recordQuery(input);
             {
-                char detailResults[MAX_RESULTS][MAX_WORD_LENGTH];
-                int detailCount = 0;
-                trie.getWordDetails(input.c_str(), detailResults, detailCount);
-                if (detailCount > 0)
+                QueryBudget budget = QueryBudget::interactive();
+                if (trie.getWordDetails(input.c_str(), queryResults, budget))
                 {
+                    formatWordDetails(trie, input.c_str(), queryResults, resultLines);
                     cout << "=== Word Details ===\n";
-                    for (int i = 0; i < detailCount; i++)
+                    for (const string &line : resultLines)
                     {
-                        cout << detailResults[i] << endl;
+                        cout << line << endl;
                     }
                     cout << "==================\n";
                 }
@@ -1427,14 +8761,15 @@ int main()
                 {
                     cout << "Word not found. Try using autocomplete to find similar words.\n";
                 }
+                reportTruncation(budget);
             }
             break;
 
         case 5: // Advanced Search
-            cout << "Enter phrase for advanced search (multiple words): ";
+            cout << "Enter phrase for advanced search (words are ANDed, OR between alternatives, -word excludes): ";
             cin.ignore();
             getline(cin, input);
-            history.addQuery(input.c_str());
+            recordQuery(input);
             {
                 if (input.empty())
                 {
@@ -1442,32 +8777,33 @@ int main()
                     break;
                 }
 
-                char advancedResults[MAX_RESULTS][MAX_WORD_LENGTH];
-                int advancedResultCount = 0;
-                if (trie.advancedSearch(input.c_str(), advancedResults, advancedResultCount))
+                QueryBudget budget = QueryBudget::interactive();
+                if (trie.advancedSearch(input.c_str(), queryResults, budget))
                 {
-                    cout << "Found " << advancedResultCount << " files containing all words in: \"" << input << "\"\n";
-                    for (int i = 0; i < advancedResultCount; i++)
+                    cout << "Found " << queryResults.hits.size() << " files matching: \"" << input << "\"\n";
+                    for (size_t i = 0; i < queryResults.hits.size(); i++)
                     {
-                        cout << (i + 1) << ". " << advancedResults[i] << endl;
+                        cout << (i + 1) << ". " << trie.getFilename(queryResults.hits[i].docId) << endl;
                     }
                 }
                 else
                 {
-                    cout << "No files found containing all words in the phrase.\n";
+                    cout << "No files found matching the query.\n";
                     cout << "Try a simpler search with fewer terms.\n";
                 }
+                reportTruncation(budget);
             }
             break;
 
         case 6: // Spell Check
             cout << "Enter word to check spelling: ";
             cin >> input;
-            history.addQuery(input.c_str());
+            recordQuery(input);
             {
                 char spellSuggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
                 int suggestionCount = 0;
-                if (trie.spellCheck(input.c_str(), spellSuggestions, suggestionCount))
+                QueryBudget budget = QueryBudget::interactive();
+                if (trie.spellCheck(input.c_str(), spellSuggestions, suggestionCount, budget))
                 {
                     cout << "Did you mean:\n";
                     for (int i = 0; i < suggestionCount; i++)
@@ -1479,6 +8815,7 @@ int main()
                 {
                     cout << "No suggestions found for the word.\n";
                 }
+                reportTruncation(budget);
             }
             break;
 
@@ -1487,26 +8824,28 @@ int main()
             cout << "Enter two words for proximity search: ";
             string word1, word2;
             cin >> word1 >> word2;
-            history.addQuery((word1 + " " + word2).c_str());
+            recordQuery(word1 + " " + word2);
             {
                 int maxDistance;
                 cout << "Enter maximum distance between words: ";
                 cin >> maxDistance;
 
-                char proximityResults[MAX_RESULTS][MAX_WORD_LENGTH];
-                int proximityResultCount = 0;
-                if (trie.proximitySearch(word1.c_str(), word2.c_str(), maxDistance, proximityResults, proximityResultCount))
+                QueryBudget budget = QueryBudget::interactive();
+                if (trie.proximitySearch(word1.c_str(), word2.c_str(), maxDistance, queryResults, budget))
                 {
-                    cout << "Found " << proximityResultCount << " results:\n";
-                    for (int i = 0; i < proximityResultCount; i++)
+                    cout << "Found " << queryResults.hits.size() << " results:\n";
+                    for (size_t i = 0; i < queryResults.hits.size(); i++)
                     {
-                        cout << (i + 1) << ". " << proximityResults[i] << endl;
+                        const SearchHit &hit = queryResults.hits[i];
+                        cout << (i + 1) << ". " << trie.getFilename(hit.docId)
+                             << " (distance: " << hit.lastPosition - hit.firstPosition << ")" << endl;
                     }
                 }
                 else
                 {
                     cout << "No proximity matches found.\n";
                 }
+                reportTruncation(budget);
             }
             break;
         }
@@ -1522,7 +8861,8 @@ int main()
 
             if (tolower(clearChoice) == 'y')
             {
-                history = SearchHistory(); // Reset the history
+                history.clear(); // Reset the history and truncate the query log
+                trie.clearQueryStats();
                 cout << "Search history cleared.\n";
             }
         }
@@ -1543,19 +8883,19 @@ int main()
                 getline(cin, searchQuery);
 
                 // Get results
-                char exportData[MAX_RESULTS][MAX_WORD_LENGTH];
-                int exportCount = 0;
-
                 if (searchQuery.find(' ') != string::npos)
                 {
                     // Advanced search for phrases
-                    trie.advancedSearch(searchQuery.c_str(), exportData, exportCount);
+                    trie.advancedSearch(searchQuery.c_str(), queryResults);
+                    formatDocumentHits(trie, queryResults, resultLines);
                 }
                 else
                 {
                     // Regular word search
-                    trie.getWordDetails(searchQuery.c_str(), exportData, exportCount);
+                    trie.getWordDetails(searchQuery.c_str(), queryResults);
+                    formatWordDetails(trie, searchQuery.c_str(), queryResults, resultLines);
                 }
+                int exportCount = resultLines.size();
 
                 string filename;
                 cout << "Enter filename to export JSON (without extension): ";
@@ -1588,7 +8928,7 @@ int main()
                     jsonFile << "      \"index\": " << (i + 1) << ",\n";
 
                     // Escape quotes and backslashes in the result
-                    string resultText = exportData[i];
+                    const string &resultText = resultLines[i];
                     string escapedResult;
                     for (char c : resultText)
                     {
@@ -1619,23 +8959,24 @@ int main()
             else if (exportType == "last" && history.count > 0)
             {
                 // Export results for last search
-                string lastQuery = history.queries[history.count - 1];
+                string lastQuery = history.recent(0);
                 cout << "Exporting results for: " << lastQuery << endl;
 
-                char exportData[MAX_RESULTS][MAX_WORD_LENGTH];
-                int exportCount = 0;
-
                 // Get results based on last query
                 char lastWord[MAX_WORD_LENGTH];
                 strncpy(lastWord, lastQuery.c_str(), MAX_WORD_LENGTH);
 
                 // Simple word search export
-                trie.getWordDetails(lastWord, exportData, exportCount);
+                trie.getWordDetails(lastWord, queryResults);
+                formatWordDetails(trie, lastWord, queryResults, resultLines);
 
-                if (exportCount == 0)
+                if (resultLines.empty())
                 {
                     // Try partial search if exact match failed
-                    trie.partialSearch(lastWord, exportData, exportCount);
+                    char partialResults[MAX_RESULTS][MAX_WORD_LENGTH];
+                    int partialCount = 0;
+                    trie.partialSearch(lastWord, partialResults, partialCount);
+                    resultLines.assign(partialResults, partialResults + partialCount);
                 }
 
                 string filename;
@@ -1657,7 +8998,7 @@ int main()
                     {
                         exportPath += ".csv";
                     }
-                    exportSuccess = trie.exportToCSV(exportPath.c_str(), exportData, exportCount);
+                    exportSuccess = trie.exportToCSV(exportPath.c_str(), resultLines);
                 }
                 else if (format == "pdf")
                 {
@@ -1666,7 +9007,7 @@ int main()
                     {
                         exportPath += ".pdf";
                     }
-                    exportSuccess = trie.exportToPDF(exportPath.c_str(), exportData, exportCount);
+                    exportSuccess = trie.exportToPDF(exportPath.c_str(), resultLines);
                 }
                 else
                 {
@@ -1675,7 +9016,7 @@ int main()
                     {
                         exportPath += ".txt";
                     }
-                    exportSuccess = trie.exportResults(exportPath.c_str(), exportData, exportCount);
+                    exportSuccess = trie.exportResults(exportPath.c_str(), resultLines);
                 }
 
                 if (exportSuccess)
@@ -1715,22 +9056,20 @@ int main()
                 }
 
                 // Prepare history data for export
-                char historyData[MAX_RESULTS][MAX_WORD_LENGTH];
-                int historyCount = 0;
-
-                for (int i = history.count - 1; i >= 0 && historyCount < MAX_RESULTS; i--)
+                vector<string> historyData;
+                for (int i = 0; i < history.count && i < MAX_RESULTS; i++)
                 {
-                    sprintf(historyData[historyCount++], "Query %d: %s", history.count - i, history.queries[i]);
+                    historyData.push_back("Query " + to_string(i + 1) + ": " + history.recent(i));
                 }
 
                 bool exportSuccess = false;
                 if (format == "csv")
                 {
-                    exportSuccess = trie.exportToCSV(exportPath.c_str(), historyData, historyCount);
+                    exportSuccess = trie.exportToCSV(exportPath.c_str(), historyData);
                 }
                 else if (format == "pdf")
                 {
-                    exportSuccess = trie.exportToPDF(exportPath.c_str(), historyData, historyCount);
+                    exportSuccess = trie.exportToPDF(exportPath.c_str(), historyData);
                 }
                 else
                 {
@@ -1741,9 +9080,9 @@ int main()
                         fprintf(file, "Search History\n");
                         fprintf(file, "--------------------------------\n");
 
-                        for (int i = history.count - 1; i >= 0; i--)
+                        for (int i = 0; i < history.count; i++)
                         {
-                            fprintf(file, "%d. %s\n", history.count - i, history.queries[i]);
+                            fprintf(file, "%d. %s\n", i + 1, history.recent(i));
                         }
 
                         fclose(file);
@@ -1768,11 +9107,7 @@ int main()
                 string wordToExport;
                 cin >> wordToExport;
 
-                char wordDetails[MAX_RESULTS][MAX_WORD_LENGTH];
-                int detailCount = 0;
-                trie.getWordDetails(wordToExport.c_str(), wordDetails, detailCount);
-
-                if (detailCount == 0)
+                if (!trie.getWordDetails(wordToExport.c_str(), queryResults))
                 {
                     cout << "No details found for the word '" << wordToExport << "'. Nothing to export." << endl;
                     break;
@@ -1801,18 +9136,19 @@ int main()
                     exportPath += ".txt";
                 }
 
+                formatWordDetails(trie, wordToExport.c_str(), queryResults, resultLines);
                 bool exportSuccess = false;
                 if (format == "csv")
                 {
-                    exportSuccess = trie.exportToCSV(exportPath.c_str(), wordDetails, detailCount);
+                    exportSuccess = trie.exportToCSV(exportPath.c_str(), resultLines);
                 }
                 else if (format == "pdf")
                 {
-                    exportSuccess = trie.exportToPDF(exportPath.c_str(), wordDetails, detailCount);
+                    exportSuccess = trie.exportToPDF(exportPath.c_str(), resultLines);
                 }
                 else
                 {
-                    exportSuccess = trie.exportResults(exportPath.c_str(), wordDetails, detailCount);
+                    exportSuccess = trie.exportResults(exportPath.c_str(), resultLines);
                 }
 
                 if (exportSuccess)
@@ -1854,15 +9190,188 @@ int main()
                 backgroundRunning = true;
                 backgroundThread = thread(backgroundIndexing, ref(trie), directory, ref(backgroundRunning));
 
-                // Detach the thread to allow it to run independently
-                backgroundThread.detach();
                 cout << "Background indexing started in directory: " << directory << "\n";
             }
             break;
         }
 
+        case 12: // Sharded Search
+        {
+            if (!shardCoordinator.running())
+            {
+                int shardCount;
+                cout << "Number of shard processes: ";
+                cin >> shardCount;
+                if (shardCount < 1)
+                {
+                    cout << "Shard count must be at least 1.\n";
+                    break;
+                }
+
+                cout << "Starting " << shardCount << " shards over " << indexedFiles.size() << " files...\n";
+                if (!shardCoordinator.start(indexedFiles, shardCount))
+                {
+                    cout << "Failed to start shards.\n";
+                    break;
+                }
+                for (int i = 0; i < shardCoordinator.shardCount(); i++)
+                {
+                    cout << "  Shard " << i << ": " << shardCoordinator.shardFileCount(i) << " files\n";
+                }
+            }
+
+            cout << "Enter queries as 'and <words>', 'rank <words>' or 'top <k> <words>'.\n";
+            cout << "'back' returns to the menu, 'stop' shuts the shards down.\n";
+            cin.ignore(1000, '\n');
+            string line;
+            while (cout << "shard> " && getline(cin, line))
+            {
+                istringstream iss(line);
+                string mode;
+                iss >> mode;
+                if (mode == "back")
+                    break;
+                if (mode == "stop")
+                {
+                    shardCoordinator.stop();
+                    cout << "Shards stopped.\n";
+                    break;
+                }
+
+                int topK = 0;
+                if (mode == "top" && !(iss >> topK))
+                {
+                    cout << "Usage: top <k> <words>\n";
+                    continue;
+                }
+                if (mode != "and" && mode != "rank" && mode != "top")
+                {
+                    cout << "Unknown query type: " << mode << "\n";
+                    continue;
+                }
+
+                vector<string> words;
+                string word, terms;
+                while (iss >> word)
+                {
+                    if (Utils::isValidWord(word))
+                    {
+                        transform(word.begin(), word.end(), word.begin(), ::tolower);
+                        words.push_back(word);
+                        terms += word + " ";
+                    }
+                }
+                recordQuery(terms);
+
+                vector<ShardHit> hits;
+                vector<double> latency;
+                shardCoordinator.query(words, mode == "and", topK, hits, latency);
+                if (!shardCoordinator.running())
+                {
+                    cout << "A shard stopped responding; all shards were shut down.\n";
+                    break;
+                }
+
+                cout << "Found " << hits.size() << " results:\n";
+                for (size_t i = 0; i < hits.size(); i++)
+                {
+                    cout << (i + 1) << ". " << hits[i].path << " (score: " << hits[i].score << ")\n";
+                }
+                for (size_t i = 0; i < latency.size(); i++)
+                {
+                    cout << "  Shard " << i << " latency: " << latency[i] << " microseconds\n";
+                }
+            }
+            break;
+        }
+
+        case 13: // Index Tools
+            runIndexTools(trie);
+            break;
+
+        case 14: // Wildcard Search
+            cout << "Enter pattern (? = one letter, * = any letters): ";
+            cin >> input;
+            recordQuery(input);
+            {
+                QueryBudget budget = QueryBudget::interactive();
+                if (trie.wildcardSearch(input.c_str(), queryResults, budget))
+                {
+                    formatTermHits(trie, queryResults, resultLines);
+                    cout << "Found " << resultLines.size() << " matching terms:\n";
+                    for (size_t i = 0; i < resultLines.size(); i++)
+                    {
+                        cout << (i + 1) << ". " << resultLines[i] << endl;
+                    }
+                }
+                else
+                {
+                    cout << "No terms match the pattern.\n";
+                }
+                reportTruncation(budget);
+            }
+            break;
+
+        case 15: // Suffix/Infix Search
+        {
+            string mode;
+            cout << "Search type (suffix/infix) and text: ";
+            cin >> mode >> input;
+            recordQuery(input);
+
+            QueryBudget budget = QueryBudget::interactive();
+            bool found = mode == "suffix" ? trie.suffixSearch(input.c_str(), queryResults, budget)
+                                          : trie.infixSearch(input.c_str(), queryResults, budget);
+            if (found)
+            {
+                formatTermHits(trie, queryResults, resultLines);
+                cout << "Found " << resultLines.size() << " matching terms:\n";
+                for (size_t i = 0; i < resultLines.size(); i++)
+                {
+                    cout << (i + 1) << ". " << resultLines[i] << endl;
+                }
+            }
+            else
+            {
+                cout << "No terms match.\n";
+            }
+            reportTruncation(budget);
+            break;
+        }
+
+        case 16: // Substring Search
+        {
+            cout << "Enter text to find inside documents: ";
+            cin.ignore();
+            getline(cin, input);
+            recordQuery(input);
+
+            int documentsChecked = 0;
+            auto startTime = chrono::high_resolution_clock::now();
+            QueryBudget budget = QueryBudget::interactive();
+            bool found = trie.substringSearch(input.c_str(), queryResults, &documentsChecked, budget);
+            auto duration = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - startTime);
+
+            if (found)
+            {
+                formatDocumentHits(trie, queryResults, resultLines);
+                cout << "Found in " << resultLines.size() << " files:\n";
+                for (size_t i = 0; i < resultLines.size(); i++)
+                {
+                    cout << (i + 1) << ". " << resultLines[i] << endl;
+                }
+            }
+            else
+            {
+                cout << "Text not found in any indexed file.\n";
+            }
+            cout << "Verified " << documentsChecked << " candidate files in " << duration.count() << " microseconds.\n";
+            reportTruncation(budget);
+            break;
+        }
+
         default:
-            cout << "Invalid choice. Please select an option from 1-11.\n";
+            cout << "Invalid choice. Please select an option from 1-16.\n";
         }
 
         // Add a pause before showing menu again